@@ -6,28 +6,27 @@
  */
 
 #include "jacobian.h"
+#ifndef JACOBIAN_NO_WIRINGPI
 #include <wiringPi.h>
+#endif
 #include <chrono>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include <malloc.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <poll.h>
+#include <linux/gpio.h>
 using namespace jacobian;
 
 /*******************
 General utilities
 /*******************/
 
-// General logging. These methods print a simple message to the terminal during runtime.
-template <typename T>
-void jacobian::log(string tag, T obj) {
-	cout << "JacobianOS [Debug Log] @ t = " << clock() 
-		<< ": [" << tag << "] " << obj << endl;
-	return;
-}
-template <typename T>
-void jacobian::log(T obj) {
-	cout << "JacobianOS [Debug Log] @ t = " << clock() 
-		<< ": " << obj << endl;
-	return;
-}
-
 /**
  * This function translates time in seconds to duty cycle with defined frequency.
  *
@@ -70,6 +69,85 @@ void jacobian::waitForSeconds(double s) {
 	return;
 }
 
+/**
+ * Read the monotonic system clock. Unlike clock(), which counts CPU time used by the process,
+ * this is wall time that never jumps, so it is safe to schedule signal edges against.
+ * 
+ * @return the current CLOCK_MONOTONIC time in nanoseconds.
+ */
+long long jacobian::monotonicNanos(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * Block the calling thread until an absolute point on the monotonic clock. The thread sleeps
+ * until shortly before the deadline and then spins the remainder, trading a little CPU for
+ * a wake-up that is not at the mercy of the scheduler's timer slack.
+ * 
+ * @params
+ * 	long long deadline: The absolute CLOCK_MONOTONIC time to wait for, in nanoseconds.
+ * 	long long spin: How long before the deadline to stop sleeping and start spinning, in nanoseconds.
+ * @return void
+ */
+void jacobian::waitUntil(long long deadline, long long spin) {
+	long long wake = deadline - spin;
+	if(wake > monotonicNanos()) {
+		struct timespec ts;
+		ts.tv_sec = wake / 1000000000LL;
+		ts.tv_nsec = wake % 1000000000LL;
+		while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+	}
+	while(monotonicNanos() < deadline);
+	return;
+}
+
+/**
+ * Put the calling thread in real-time mode: pin it to one CPU, raise it to SCHED_FIFO, and lock
+ * and pre-fault the process memory so that no page fault lands in the middle of a pulse. Every
+ * step is attempted independently and logged; a step that lacks the privilege it needs is skipped.
+ * Threads created afterwards inherit the affinity and policy, so call this after starting threads
+ * that should stay ordinary.
+ * 
+ * @params
+ * 	int cpu: The CPU to pin the thread to (preferably one isolated with isolcpus=), or -1 to leave it.
+ * 	int priority: The SCHED_FIFO priority [1 - 99], or 0 to leave the policy.
+ * @return the settings that were applied.
+ */
+RealtimeStatus jacobian::makeRealtime(int cpu, int priority) {
+	RealtimeStatus status;
+	if(cpu >= 0) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+		status.pinned = (err == 0);
+		if(status.pinned) log("Real-time", "Output thread pinned to CPU " + to_string(cpu) + ".");
+		else log("Warning", "Could not pin output thread to CPU " + to_string(cpu) + ": " + string(strerror(err)));
+	}
+	if(priority > 0) {
+		struct sched_param param;
+		param.sched_priority = priority;
+		int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+		status.fifo = (err == 0);
+		if(status.fifo) log("Real-time", "Output thread running under SCHED_FIFO, priority " + to_string(priority) + ".");
+		else log("Warning", "Could not enable SCHED_FIFO: " + string(strerror(err)));
+	}
+	if(mlockall(MCL_CURRENT | MCL_FUTURE) == 0) {
+		// Keep freed heap memory in the process, and touch a generous slab of stack now,
+		// so neither has to be faulted in again later.
+		mallopt(M_TRIM_THRESHOLD, -1);
+		mallopt(M_MMAP_MAX, 0);
+		volatile unsigned char stack[64 * 1024];
+		for(size_t i = 0; i < sizeof(stack); i += 4096)
+			stack[i] = 0;
+		status.locked = true;
+		log("Real-time", "Process memory locked and pre-faulted.");
+	} else log("Warning", "Could not lock process memory: " + string(strerror(errno)));
+	return status;
+}
+
 /**
  * Return a list of strings seperated from every occurence of a specified delimiter.
  * 
@@ -88,212 +166,2157 @@ vector<string> jacobian::tokenize(string in, char delimiter) {
 }
 
 /*******************
-Controller object
+Logging
 /*******************/
 
-// Controller constructor.
-Controller::Controller(string name) {
-	if(!init()) {
-		log("FATAL", "JacobianOS has encountered an error. See log.txt");
-		exit(-1);
+namespace {
+	const size_t LOG_CAPACITY = 1024; // Messages the ring holds (a power of two).
+	const int LOG_TAGS = 64; // Distinct tags; messages with tags beyond these are logged untagged.
+	const size_t LOG_HEAD = 96; // Room for the timestamp and the longest tag in front of a message.
+
+	// One queued message. Its sequence number says whether it is free to write or ready to read.
+	struct LogSlot {
+		atomic<size_t> sequence;
+		long long time;
+		int tag;
+		size_t length;
+		char text[LOG_TEXT];
+	};
+
+	/**
+	 * The ring itself is a bounded multi-producer queue: a producer claims a slot by advancing
+	 * the enqueue position, fills it in and publishes it through the slot's sequence number.
+	 * The only consumer is whoever holds drainLock, normally the drain thread.
+	 */
+	struct Logger {
+		LogSlot slots[LOG_CAPACITY];
+		atomic<size_t> enqueued;
+		size_t dequeued = 0;
+		atomic<long long> drops;
+		long long dropsReported = 0;
+		char tags[LOG_TAGS][24]; // Tag names by id. Id 0 means no tag; names are only ever appended.
+		atomic<int> tagCount;
+		mutex tagLock, drainLock;
+		atomic<bool> console, running;
+		string path = "log.txt";
+		long long maxBytes = 1000000, written = 0;
+		ofstream file;
+		bool opened = false; // Has the file been opened yet? Not until the first message is written.
+		long long start;
+		thread drainer;
+
+		Logger(void) {
+			for(size_t i = 0; i < LOG_CAPACITY; i++) slots[i].sequence = i;
+			enqueued = 0;
+			drops = 0;
+			tagCount = 1;
+			console = running = true;
+			start = monotonicNanos();
+			drainer = thread([this]() {
+				while(running.load(memory_order_relaxed)) {
+					this_thread::sleep_for(chrono::milliseconds(10));
+					lock_guard<mutex> lock(drainLock);
+					drain();
+				}
+			});
+		}
+
+		~Logger(void) {
+			running = false;
+			if(drainer.joinable()) drainer.join();
+			lock_guard<mutex> lock(drainLock);
+			drain();
+		}
+
+		// (Re)open the log file for appending. Call with drainLock held.
+		void open(void) {
+			if(file.is_open()) file.close();
+			opened = true;
+			file.open(path, ios::app);
+			written = (file.is_open()) ? (long long)file.tellp() : 0;
+		}
+
+		// Look up the id of a tag, adding it the first time it is seen.
+		int tagId(const char * tag) {
+			if(tag == nullptr) return 0;
+			int count = tagCount.load(memory_order_acquire);
+			for(int i = 1; i < count; i++)
+				if(strncmp(tags[i], tag, sizeof(tags[i]) - 1) == 0) return i;
+			lock_guard<mutex> lock(tagLock);
+			count = tagCount.load(memory_order_relaxed);
+			for(int i = 1; i < count; i++)
+				if(strncmp(tags[i], tag, sizeof(tags[i]) - 1) == 0) return i;
+			if(count == LOG_TAGS) return 0;
+			strncpy(tags[count], tag, sizeof(tags[count]) - 1);
+			tags[count][sizeof(tags[count]) - 1] = '\0';
+			tagCount.store(count + 1, memory_order_release);
+			return count;
+		}
+
+		// Queue a message. Returns false, and counts a drop, if the ring is full.
+		bool push(long long time, int tag, const char * text, size_t length) {
+			size_t position = enqueued.load(memory_order_relaxed);
+			LogSlot * slot;
+			while(true) {
+				slot = &slots[position % LOG_CAPACITY];
+				long long ahead = (long long)slot->sequence.load(memory_order_acquire) - (long long)position;
+				if(ahead == 0) {
+					if(enqueued.compare_exchange_weak(position, position + 1, memory_order_relaxed)) break;
+				} else if(ahead < 0) {
+					drops.fetch_add(1, memory_order_relaxed);
+					return false;
+				} else position = enqueued.load(memory_order_relaxed);
+			}
+			slot->time = time;
+			slot->tag = tag;
+			slot->length = min(length, LOG_TEXT);
+			memcpy(slot->text, text, slot->length);
+			slot->sequence.store(position + 1, memory_order_release);
+			return true;
+		}
+
+		// Write one message to the console and the log file. Call with drainLock held.
+		void write(long long time, int tag, const char * text, size_t length) {
+			// The header is cut short rather than overrun, should the uptime ever grow that long.
+			char line[LOG_HEAD + LOG_TEXT + 1];
+			size_t head = min((size_t)max(snprintf(line, LOG_HEAD, "JacobianOS [Debug Log] @ t = %.3fms: ", 
+				(time - start) / 1000000.0), 0), LOG_HEAD - 1);
+			if(tag > 0) head = min(head + max(snprintf(line + head, LOG_HEAD - head, "[%s] ", tags[tag]), 0), LOG_HEAD - 1);
+			length = min(length, LOG_TEXT);
+			memcpy(line + head, text, length);
+			line[head + length] = '\n';
+			size_t size = head + length + 1;
+			if(console.load(memory_order_relaxed)) fwrite(line, 1, size, stdout);
+			// The file is opened by the first message, so a path chosen before then is the only one made.
+			if(!opened) open();
+			if(file.is_open()) {
+				file.write(line, size);
+				written += size;
+			}
+		}
+
+		// Write out everything queued, then rotate the log file if it has grown too big. Call with drainLock held.
+		void drain(void) {
+			bool any = false;
+			while(true) {
+				LogSlot & slot = slots[dequeued % LOG_CAPACITY];
+				if(slot.sequence.load(memory_order_acquire) != dequeued + 1) break;
+				write(slot.time, slot.tag, slot.text, slot.length);
+				slot.sequence.store(dequeued + LOG_CAPACITY, memory_order_release);
+				dequeued++;
+				any = true;
+			}
+			long long dropped = drops.load(memory_order_relaxed);
+			if(dropped != dropsReported) {
+				string note = to_string(dropped - dropsReported) + " messages were dropped because the log ring was full.";
+				write(monotonicNanos(), tagId("Log"), note.c_str(), note.size());
+				dropsReported = dropped;
+				any = true;
+			}
+			if(!any) return;
+			fflush(stdout);
+			file.flush();
+			if(written > maxBytes) {
+				file.close();
+				rename(path.c_str(), (path + ".1").c_str());
+				open();
+			}
+		}
+	};
+
+	atomic<bool> loggerClosed(false);
+
+	// The logger is made by the first message and outlives every static that logs while being made.
+	Logger & logger(void) {
+		static struct Instance : Logger {
+			~Instance(void) { loggerClosed = true; }
+		} instance;
+		return instance;
 	}
-	setName(name);
-	setState(true);
-	log("Success", "JacobianOS successfully initialized.");
 }
 
 /**
- * This function is called automatically when a new Controller is constructed.
- * Its main purpose is to initiate wiringPI (selected GPIO library).
+ * Queue one preformatted message. This is what log() calls; it never blocks unless the tag is
+ * "FATAL", in which case everything queued is written out before the call returns.
+ * 
+ * @params
+ * 	const char * tag: The tag of the message, or nullptr for none.
+ * 	const char * text: The message (need not be terminated).
+ * 	size_t length: The length of the message.
  */
-bool Controller::init(void) {
-	if (wiringPiSetup() != 0) 
-		return false;
-	return true;
+void jacobian::logRecord(const char * tag, const char * text, size_t length) {
+	if(loggerClosed.load(memory_order_relaxed)) {
+		// The program is shutting down and the logger is gone, so write straight to the console.
+		cout << "JacobianOS [Debug Log]: " << (tag ? string("[") + tag + "] " : string()) << string(text, length) << endl;
+		return;
+	}
+	Logger & l = logger();
+	long long now = monotonicNanos();
+	int id = l.tagId(tag);
+	if(tag != nullptr && strcmp(tag, "FATAL") == 0) {
+		lock_guard<mutex> lock(l.drainLock);
+		l.drain();
+		l.write(now, id, text, min(length, LOG_TEXT));
+		fflush(stdout);
+		l.file.flush();
+		return;
+	}
+	l.push(now, id, text, length);
+	return;
+}
+
+// Write out every queued message now, from the calling thread.
+void jacobian::flushLog(void) {
+	if(loggerClosed.load(memory_order_relaxed)) return;
+	Logger & l = logger();
+	lock_guard<mutex> lock(l.drainLock);
+	l.drain();
+	return;
 }
 
 /**
- * This function MUST be called after every JacobianOS program. It resets the state of the
- * configured GPIO pins to a neutral state. This is to avoid any electrical discharge
- * or damage of componets after use.
+ * Choose the log file. When it grows past maxBytes it is renamed with a ".1" suffix, replacing
+ * the previous one, and a new file is started. Nothing is created in the working directory if this
+ * is called before anything has been written out; the messages queued so far go to the new file.
+ * 
+ * @params
+ * 	string path: The log file ("log.txt" in the working directory by default).
+ * 	long long maxBytes: The size at which the file is rotated.
  */
-void Controller::kill(void) {
-	for(pair<string, int> pin : pinout) {
-		setPin(pin.first, 0);
-		setPinMode(pin.first, INPUT);
-	}
-	log("Success", "Controller terminated. It is now safe to touch the electronic components.");
+void jacobian::setLogFile(string path, long long maxBytes) {
+	Logger & l = logger();
+	lock_guard<mutex> lock(l.drainLock);
+	if(l.opened) l.drain();
+	l.path = path;
+	l.maxBytes = maxBytes;
+	l.open();
 	return;
 }
 
-// Return if the controller is currently overriden by manual controller.
-bool Controller::isOverridden(void) {
-	return this->overriden;
+// Turn echoing log messages to the console on or off. The log file always gets them.
+void jacobian::setLogConsole(bool on) {
+	logger().console = on;
+	return;
 }
 
-// Set the state of the Controller override.
-void Controller::Override(bool verdict) {
-	this->overriden = verdict;
-	if(verdict) log("Success", "The Controller is no longer in control of the RC car.");
-	else log("Success", "The Controller is now in direct control of the RC car.");
-	return;
+// Return how many messages have been dropped because the ring was full.
+long long jacobian::getLogDrops(void) {
+	return logger().drops.load(memory_order_relaxed);
 }
 
-// Return the distinct name of the Controller.
-string Controller::getName(void) {
-	return this->name;
+/*******************
+Flight recorder
+/*******************/
+
+namespace {
+	atomic<FlightRecorder *> flightRecorder(nullptr);
 }
 
-// Set the name of the Controller.
-void Controller::setName(string name) {
-	this->name = name;
-	return;
+/**
+ * FlightRecorder constructor. An existing recording of the same capacity is carried on, so the
+ * events leading up to a crash are still there after a restart until the ring wraps onto them.
+ * 
+ * @params
+ * 	string path: The recording file.
+ * 	unsigned long long capacity: The number of records the ring holds.
+ */
+FlightRecorder::FlightRecorder(string path, unsigned long long capacity) {
+	this->path = path;
+	this->header = nullptr;
+	this->records = nullptr;
+	this->bytes = FlightHeader::SIZE + capacity * sizeof(FlightRecord);
+	int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if(fd < 0 || ftruncate(fd, bytes) != 0) {
+		log("Error", "Could not open flight recording " + path + ": " + string(strerror(errno)));
+		if(fd >= 0) close(fd);
+		return;
+	}
+	void * memory = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+	close(fd);
+	if(memory == MAP_FAILED) {
+		log("Error", "Could not map flight recording " + path + ": " + string(strerror(errno)));
+		return;
+	}
+	header = (FlightHeader *)memory;
+	records = (FlightRecord *)((char *)memory + FlightHeader::SIZE);
+	if(header->magic != FlightHeader::MAGIC || header->capacity != capacity || header->recordSize != sizeof(FlightRecord)) {
+		memset(memory, 0, bytes);
+		header->version = 1;
+		header->recordSize = sizeof(FlightRecord);
+		header->capacity = capacity;
+		header->head = 0;
+		struct timespec now;
+		clock_gettime(CLOCK_REALTIME, &now);
+		header->monotonic = monotonicNanos();
+		header->realtime = now.tv_sec * 1000000000LL + now.tv_nsec;
+		header->magic = FlightHeader::MAGIC;
+	}
 }
 
-// Set whether or not the Controller is on or off.
-void Controller::setState(bool state) {
-	this->running = state;
+// FlightRecorder destructor. The file stays; the kernel writes it back whenever it likes.
+FlightRecorder::~FlightRecorder(void) {
+	if(flightRecorder.load() == this) install(nullptr);
+	if(header != nullptr) munmap(header, bytes);
 }
 
-// Is the controller on or off?
-bool Controller::isRunning(void) {
-	return this->running;
+// Is the recording file mapped?
+bool FlightRecorder::isOpen(void) {
+	return this->header != nullptr;
 }
 
 /**
- * This function will return the pin ID of the current active pinouts by name.
+ * Record one event. Safe from any thread, and costs a few tens of nanoseconds.
  * 
  * @params
- * 	string pinName: The name of the pin you are searching for.
- * @return the integer pin ID from name if it exists, otherwise -1.
+ * 	unsigned type: The FLIGHTEVENT.
+ * 	int channel: The PWM channel, or -1.
+ * 	long long a: The first value.
+ * 	long long b: The second value.
+ * 	long long time: The CLOCK_MONOTONIC time of the event, if not now (ns).
+ */
+void FlightRecorder::record(unsigned type, int channel, long long a, long long b, long long time) {
+	if(header == nullptr) return;
+	unsigned long long n = header->head.fetch_add(1, memory_order_relaxed);
+	FlightRecord & slot = records[n % header->capacity];
+	// Mark the slot incomplete before overwriting it, so a torn record is never mistaken for a whole one.
+	slot.sequence.store(0, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	slot.time = (time < 0) ? monotonicNanos() : time;
+	slot.type = type;
+	slot.channel = channel;
+	slot.a = a;
+	slot.b = b;
+	slot.sequence.store(n + 1, memory_order_release);
+}
+
+/**
+ * Record a command line. Only its first 16 characters are kept.
+ * 
+ * @params
+ * 	string_view line: The command.
+ * 	long long time: The CLOCK_MONOTONIC time it arrived, if not now (ns).
+ */
+void FlightRecorder::command(string_view line, long long time) {
+	long long text[2] = { 0, 0 };
+	memcpy(text, line.data(), min(line.size(), sizeof(text)));
+	record(FLIGHT_COMMAND, -1, text[0], text[1], time);
+}
+
+// Make a recorder the one recordFlight() writes to, or pass nullptr for none.
+void FlightRecorder::install(FlightRecorder * recorder) {
+	flightRecorder.store((recorder != nullptr && recorder->isOpen()) ? recorder : nullptr, memory_order_release);
+}
+
+// Record an event with the installed flight recorder, if there is one. See FlightRecorder::record().
+void jacobian::recordFlight(unsigned type, int channel, long long a, long long b) {
+	FlightRecorder * recorder = flightRecorder.load(memory_order_acquire);
+	if(recorder != nullptr) recorder->record(type, channel, a, b);
+}
+
+/**
+ * HardwarePWM constructor. Nothing is touched until open().
+ * 
+ * @params
+ * 	int chip: The PWM chip (pwmchipN).
+ * 	int channel: The channel of the chip (pwmM).
+ * 	string root: The sysfs PWM class directory.
  */
-int Controller::returnPinFromName(string pinName) {
-	for(int i = 0; i < this->pinout.size(); i++) {
-		if(this->pinout[i].first == pinName)
-			return this->pinout[i].second;
+HardwarePWM::HardwarePWM(int chip, int channel, string root) {
+	this->chip = chip;
+	this->channel = channel;
+	this->root = root;
+	this->enabled = false;
+}
+
+HardwarePWM::~HardwarePWM(void) {
+	{
+		lock_guard<mutex> lock(openLock());
+		vector<HardwarePWM *> & list = opened();
+		list.erase(remove(list.begin(), list.end(), this), list.end());
 	}
-	log("Error", "No pin was found with this name: " + pinName);
-	return -1;
+	disable();
+	if(periodFd >= 0) close(periodFd);
+	if(dutyFd >= 0) close(dutyFd);
+	if(enableFd >= 0) close(enableFd);
 }
 
 /**
- * This function will set the pin mode (see WiringPI pinMode for specfic modes) of the pin by name, if it exists.
+ * Find the hardware PWM channel of a pin, if it has one (Raspberry Pi: GPIO 12 and 18 are
+ * channel 0, GPIO 13 and 19 are channel 1, both on pwmchip0).
  * 
  * @params
- * 	string pinName: The name of the pin you are setting the mode for.
- * 	int mode: The mode you would like to set.
+ * 	int pin: The wiringPi pin ID.
+ * 	int chip (reference): Set to the PWM chip.
+ * 	int channel (reference): Set to the PWM channel.
+ * @return true if the pin has a hardware PWM channel.
  */
-void Controller::setPinMode(string pinName, int mode) {
-	int pin = returnPinFromName(pinName);
-	if(pin == -1) return;
-	pinMode(pin, mode);
-	return; 
+bool HardwarePWM::channelOf(int pin, int & chip, int & channel) {
+	int gpio = MappedGPIO::toBCM(pin);
+	if(gpio != 12 && gpio != 13 && gpio != 18 && gpio != 19) return false;
+	chip = 0;
+	channel = (gpio == 12 || gpio == 18) ? 0 : 1;
+	return true;
 }
 
 /**
- * This function will set the pin pull up resistor (see WiringPi pud for specific states) of the pin by name, if it exists.
+ * Export the channel if needed and open its period, duty_cycle and enable files.
+ * 
+ * @return true if the channel is ready to use.
+ */
+bool HardwarePWM::open(void) {
+	string chipPath = root + "/pwmchip" + to_string(chip);
+	channelPath = chipPath + "/pwm" + to_string(channel);
+	struct stat info;
+	if(stat(channelPath.c_str(), &info) != 0) {
+		int fd = ::open((chipPath + "/export").c_str(), O_WRONLY | O_CLOEXEC);
+		if(fd < 0) return false;
+		string number = to_string(channel);
+		bool exported = (::write(fd, number.c_str(), number.size()) == (ssize_t)number.size());
+		close(fd);
+		// The kernel creates the channel directory, and udev may take a moment to open it up.
+		for(int i = 0; exported && i < 50 && access((channelPath + "/enable").c_str(), W_OK) != 0; i++)
+			this_thread::sleep_for(chrono::milliseconds(2));
+	}
+	periodFd = ::open((channelPath + "/period").c_str(), O_WRONLY | O_CLOEXEC);
+	dutyFd = ::open((channelPath + "/duty_cycle").c_str(), O_WRONLY | O_CLOEXEC);
+	enableFd = ::open((channelPath + "/enable").c_str(), O_WRONLY | O_CLOEXEC);
+	if(periodFd < 0 || dutyFd < 0 || enableFd < 0) {
+		log("Error", "Could not open hardware PWM channel at " + channelPath + ".");
+		return false;
+	}
+	lock_guard<mutex> lock(openLock());
+	static bool registered = false;
+	if(!registered) registered = (atexit(disableAll) == 0);
+	opened().push_back(this);
+	return true;
+}
+
+// Replace the contents of one of the channel's files with a number.
+bool HardwarePWM::put(int fd, long long value) {
+	char text[24];
+	int length = snprintf(text, sizeof(text), "%lld", value);
+	if(pwrite(fd, text, length, 0) != length) return false;
+	ftruncate(fd, length); // Only matters for an ordinary file standing in for sysfs.
+	return true;
+}
+
+/**
+ * Generate a signal with the given period and pulse width. Files are only written when their
+ * value changes, and in an order that keeps the duty cycle within the period at every step.
  * 
  * @params
- * 	string pinName: The name of the pin you are setting the pull up for.
- * 	int pud: The pull up mode you are setting it to.
+ * 	long long newPeriod: The period (ns).
+ * 	long long newHighTime: The pulse width (ns).
  */
-void Controller::setPinPud(string pinName, int pud) {
-	int pin = returnPinFromName(pinName);
-	if(pin == -1) return;
-	pullUpDnControl(pin, pud);
+void HardwarePWM::update(long long newPeriod, long long newHighTime) {
+	if(periodFd < 0) return;
+	if(newPeriod != period && newPeriod < period) {
+		// Shrinking: bring the duty cycle down first.
+		if(newHighTime != highTime && put(dutyFd, newHighTime)) highTime = newHighTime;
+		if(put(periodFd, newPeriod)) period = newPeriod;
+	} else if(newPeriod != period) {
+		if(put(periodFd, newPeriod)) period = newPeriod;
+	}
+	if(newHighTime != highTime && put(dutyFd, newHighTime)) highTime = newHighTime;
+	if(!enabled && put(enableFd, 1)) enabled = true;
+}
+
+// Stop the signal.
+void HardwarePWM::disable(void) {
+	if(enabled.load() && put(enableFd, 0)) enabled = false;
+}
+
+/**
+ * Stop the signal of every open channel. Controller::kill() calls this, and so does exit(), so a
+ * FATAL error does not leave the kernel putting out the last duty cycle. It is safe from any thread.
+ */
+void HardwarePWM::disableAll(void) {
+	lock_guard<mutex> lock(openLock());
+	for(HardwarePWM * pwm : opened()) pwm->disable();
 	return;
 }
 
+// The lock over the list of open channels. Never destroyed, so it outlives every static channel.
+mutex & HardwarePWM::openLock(void) {
+	static mutex * lock = new mutex();
+	return *lock;
+}
+
+// The channels open now (under openLock()).
+vector<HardwarePWM *> & HardwarePWM::opened(void) {
+	static vector<HardwarePWM *> * list = new vector<HardwarePWM *>();
+	return *list;
+}
+
+/*******************
+GPIO backends
+/*******************/
+
 /**
- * This function will read the digital value of the current pin by name, if it exists.
+ * Drive several pins at once by wiringPi pin ID. Backends that can write many pins in one
+ * access override this; by default each pin is written on its own.
  * 
  * @params
- * 	string pinName: The name of the pin.
- * @return the value of the pin.
+ * 	unsigned long long set: The pins to drive logic HIGH.
+ * 	unsigned long long clear: The pins to drive logic LOW.
+ */
+void GPIOBackend::writeMask(unsigned long long set, unsigned long long clear) {
+	for(int pin = 0; set || clear; pin++, set >>= 1, clear >>= 1) {
+		if(set & 1) write(pin, 1);
+		else if(clear & 1) write(pin, 0);
+	}
+	return;
+}
+
+#ifndef JACOBIAN_NO_WIRINGPI
+// Initiate wiringPi.
+bool WiringPiGPIO::init(void) {
+	return wiringPiSetup() == 0;
+}
+
+/**
+ * Set a pin's mode. PWM_OUTPUT only selects the pin's PWM ALT function: wiringPi's own PWM_OUTPUT
+ * would also reprogram the PWM clock and registers underneath the kernel driver that HardwarePWM
+ * uses, and needs root.
  */
-int Controller::readPin(string pinName) {
-	int pin = returnPinFromName(pinName);
-	if(pin == -1) return -1;
+void WiringPiGPIO::setMode(int pin, int mode) {
+	if(mode == PWM_OUTPUT) {
+		int function = MappedGPIO::pwmFunction(pin);
+		if(function >= 0) pinModeAlt(pin, function);
+		return;
+	}
+	pinMode(pin, mode);
+}
+
+void WiringPiGPIO::setPud(int pin, int pud) {
+	pullUpDnControl(pin, pud);
+}
+
+int WiringPiGPIO::read(int pin) {
 	return digitalRead(pin);
 }
 
+void WiringPiGPIO::write(int pin, int value) {
+	digitalWrite(pin, value);
+}
+#endif
+
+// MappedGPIO constructor. Nothing is mapped until init().
+MappedGPIO::MappedGPIO(string path) {
+	this->path = path;
+}
+
+MappedGPIO::~MappedGPIO(void) {
+	if(registers != nullptr) munmap((void *)registers, BLOCK_SIZE);
+	if(fd >= 0) close(fd);
+}
+
 /**
- * This function will set the digital value of the pin by name, if it exists.
+ * Map the register block. An ordinary file is created or grown to a full block first, unless the
+ * path is under /dev: that must be the real device, so a missing one is an error rather than a
+ * file that would silently drive nothing.
+ * 
+ * @return true if the registers are mapped.
+ */
+bool MappedGPIO::init(void) {
+	bool device = path.compare(0, 5, "/dev/") == 0;
+	fd = open(path.c_str(), O_RDWR | O_SYNC | O_CLOEXEC | ((device) ? 0 : O_CREAT), 0644);
+	if(fd < 0) {
+		log("Error", "Could not open GPIO registers at " + path + ": " + string(strerror(errno)) 
+			+ ((device && errno == ENOENT) ? ". Is this a Raspberry Pi? Give --gpiomem a file path to run without one." : ""));
+		return false;
+	}
+	struct stat info;
+	if(fstat(fd, &info) == 0 && device && S_ISREG(info.st_mode)) {
+		log("Error", path + " is an ordinary file, not the GPIO device, so no pin would be driven.");
+		return false;
+	}
+	if(fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size < (off_t)BLOCK_SIZE 
+		&& ftruncate(fd, BLOCK_SIZE) != 0) {
+		log("Error", "Could not size GPIO register file " + path + ".");
+		return false;
+	}
+	void * block = mmap(NULL, BLOCK_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(block == MAP_FAILED) {
+		log("Error", "Could not map GPIO registers at " + path + ": " + string(strerror(errno)));
+		return false;
+	}
+	registers = (volatile uint32_t *)block;
+	return true;
+}
+
+/**
+ * Translate a wiringPi pin ID to a BCM GPIO number (Raspberry Pi model B rev 2 and later).
  * 
  * @params
- * 	string pinName: The name of the pin.
- * 	int value: The digital value.
+ * 	int pin: The wiringPi pin ID.
+ * @return the BCM GPIO number, or -1 if the pin has none.
  */
-void Controller::setPin(string pinName, int value) {
-	int pin = returnPinFromName(pinName);
-	if(pin == -1) return;
-	digitalWrite(pin, value);
-	return;
+int MappedGPIO::toBCM(int pin) {
+	static const int BCM[32] = { 17, 18, 27, 22, 23, 24, 25, 4, 2, 3, 8, 7, 10, 9, 11, 14, 
+		15, 28, 29, 30, 31, 5, 6, 13, 19, 26, 12, 16, 20, 21, 0, 1 };
+	return (pin >= 0 && pin < 32) ? BCM[pin] : -1;
 }
 
 /**
- * This function will add and configure a new pinout on the controller.
- * You must create a pin with this function in order to edit properties of the pin.
+ * Find the GPFSEL function that hands a pin to the PWM peripheral: ALT0 on GPIO 12 and 13 and
+ * ALT5 on GPIO 18 and 19.
  * 
  * @params
- * 	int id: The ID (location) of the pin (use $ gpio readall to find correct ID).
- * 	string name: The name of the pin you can use as a unique reference.
- * 	int mode: The default mode of the pin.
- * 	int pud: The default pull resistor mode of the pin.
+ * 	int pin: The wiringPi pin ID.
+ * @return the function code (ALT0 = 4, ALT5 = 2), or -1 if the pin has no PWM channel.
  */
-void Controller::configurePin(int id, string pinName, int mode, int pud) {
-	pair<string, int> pin = make_pair(pinName, id);
-	this->pinout.push_back(pin);
-	setPinMode(pinName, mode);
-	setPinPud(pinName, pud);
-	log("Success", "A new pin has been configured! Pin ID: " 
-		+ to_string(id) + ", pinName: " + pinName + ".");
-	return;
+int MappedGPIO::pwmFunction(int pin) {
+	int gpio = toBCM(pin);
+	return (gpio == 12 || gpio == 13) ? 4 : (gpio == 18 || gpio == 19) ? 2 : -1;
 }
-	
-/*******************
-Pulse Width Modulation generator
-/*******************/
 
-// PWM constructor.
-PWM::PWM(int freq, double duty) {
-	this->frequency = freq;
-	this->dutyCycle = duty;
-	precisionPeriod = (1 / (float)frequency) * (PRECISION);
+// Set a pin's function to input or output in its GPFSEL register (3 bits per pin).
+void MappedGPIO::setMode(int pin, int mode) {
+	int gpio = toBCM(pin);
+	if(gpio < 0) return;
+	volatile uint32_t * fsel = registers + GPFSEL0 + gpio / 10;
+	int shift = (gpio % 10) * 3;
+	unsigned function = 0; // Input.
+	if(mode == OUTPUT) function = 1;
+	else if(mode == PWM_OUTPUT) function = (pwmFunction(pin) >= 0) ? pwmFunction(pin) : 1;
+	*fsel = (*fsel & ~(7u << shift)) | (function << shift);
+}
+
+// Set a pin's pull resistor with the BCM2835 GPPUD / GPPUDCLK sequence.
+void MappedGPIO::setPud(int pin, int pud) {
+	int gpio = toBCM(pin);
+	if(gpio < 0) return;
+	registers[GPPUD] = pud & 3;
+	this_thread::sleep_for(chrono::microseconds(5)); // The control signal needs 150 cycles to settle.
+	registers[GPPUDCLK0 + gpio / 32] = 1u << (gpio % 32);
+	this_thread::sleep_for(chrono::microseconds(5));
+	registers[GPPUD] = 0;
+	registers[GPPUDCLK0 + gpio / 32] = 0;
+}
+
+// Read a pin's level from GPLEV.
+int MappedGPIO::read(int pin) {
+	int gpio = toBCM(pin);
+	if(gpio < 0) return -1;
+	return (registers[GPLEV0 + gpio / 32] >> (gpio % 32)) & 1;
+}
+
+// Drive a pin by writing its bit to GPSET or GPCLR.
+void MappedGPIO::write(int pin, int value) {
+	int gpio = toBCM(pin);
+	if(gpio < 0) return;
+	registers[(value ? GPSET0 : GPCLR0) + gpio / 32] = 1u << (gpio % 32);
 }
 
 /**
- * Set the duty cycle of the PWM signal.
+ * Drive several pins at once. The masks are translated to BCM numbering and written with
+ * one store per register, so pins in the same bank switch together.
  * 
  * @params
- * 	double duty: The duty cycle [0.1% - 100%].
+ * 	unsigned long long set: The pins (wiringPi IDs) to drive logic HIGH.
+ * 	unsigned long long clear: The pins (wiringPi IDs) to drive logic LOW.
  */
-void PWM::setDutyCycle(double duty) {
-	duty = (duty > 100.0f) ? 100.0f : duty;
-	duty = (duty <= 0.0f) ? 0.1f : duty;
-	this->dutyCycle = duty;
+void MappedGPIO::writeMask(unsigned long long set, unsigned long long clear) {
+	unsigned long long bcmSet = 0, bcmClear = 0;
+	for(; set; set &= set - 1) {
+		int gpio = toBCM(__builtin_ctzll(set));
+		if(gpio >= 0) bcmSet |= 1ULL << gpio;
+	}
+	for(; clear; clear &= clear - 1) {
+		int gpio = toBCM(__builtin_ctzll(clear));
+		if(gpio >= 0) bcmClear |= 1ULL << gpio;
+	}
+	if(bcmSet & 0xFFFFFFFFULL) registers[GPSET0] = (uint32_t)bcmSet;
+	if(bcmSet >> 32) registers[GPSET0 + 1] = (uint32_t)(bcmSet >> 32);
+	if(bcmClear & 0xFFFFFFFFULL) registers[GPCLR0] = (uint32_t)bcmClear;
+	if(bcmClear >> 32) registers[GPCLR0 + 1] = (uint32_t)(bcmClear >> 32);
+}
+
+// Return the mapped register block, BLOCK_SIZE bytes long.
+volatile uint32_t * MappedGPIO::getRegisters(void) {
+	return this->registers;
 }
 
 /**
- * This method must be called every undelayed loop cycle in PI main
- * loop while controller is active. This will update the state of the
- * PWM as time moves.
+ * ChardevGPIO constructor. Nothing is opened until init().
+ * 
+ * @params
+ * 	string path: The GPIO chip device.
+ * 	bool translate: Translate wiringPi pin IDs to BCM line offsets (true on a Pi), or use the
+ * 	pin ID as the offset (for simulated chips).
  */
-void PWM::tick(void) {
-	last = now;
-	now = clock();
-	delta += (now - last);
+ChardevGPIO::ChardevGPIO(string path, bool translate) {
+	this->path = path;
+	this->translate = translate;
+	this->dirty = false;
+	for(int i = 0; i < 64; i++) index[i] = -1;
+}
 
-	precisionSince = delta / (CLOCKS_PER_SEC / PRECISION);
-	if(precisionSince <= (precisionPeriod * (this->dutyCycle / 100.0f))) {
-		on = true;
-		return;
-	} else if (precisionSince >= precisionPeriod)
-		delta = 0;
-	on = false;
+ChardevGPIO::~ChardevGPIO(void) {
+	if(request >= 0) close(request);
+	if(chip >= 0) close(chip);
 }
 
-// Evaluate the current state of the PWM signal: logic HIGH or LOW.
-bool PWM::eval(void) {
-	return this->on;
+// Open the GPIO chip.
+bool ChardevGPIO::init(void) {
+	chip = open(path.c_str(), O_RDWR | O_CLOEXEC);
+	if(chip < 0) {
+		log("Error", "Could not open GPIO chip " + path + ": " + string(strerror(errno)));
+		return false;
+	}
+	return true;
+}
+
+// Return the position of a pin's line in the request, adding the line if it is new (or -1).
+int ChardevGPIO::lineOf(int pin) {
+	if(pin < 0 || pin >= 64) return -1;
+	if(index[pin] >= 0) return index[pin];
+	int offset = (translate) ? MappedGPIO::toBCM(pin) : pin;
+	if(offset < 0) return -1;
+	Line line;
+	line.pin = pin;
+	line.offset = offset;
+	lines.push_back(line);
+	index[pin] = lines.size() - 1;
+	dirty = true;
+	return index[pin];
+}
+
+/**
+ * Make the configured lines take effect. All lines are requested together. If the set of lines
+ * is unchanged the existing request is reconfigured in place, and output levels are carried over.
+ * Only one thread makes the request; any other that finds the lines dirty waits for it.
+ * 
+ * @return true if there is a valid line request.
+ */
+bool ChardevGPIO::commit(void) {
+	if(!dirty.load(memory_order_acquire)) return request >= 0;
+	lock_guard<mutex> hold(commitLock);
+	if(!dirty.load(memory_order_relaxed)) return request >= 0;
+	if(lines.empty()) {
+		// Nothing is left to request, so let go of the lines held.
+		if(request >= 0) close(request);
+		request = -1;
+		requested = 0;
+		dirty = false;
+		return false;
+	}
+	struct gpio_v2_line_config config;
+	memset(&config, 0, sizeof(config));
+	unsigned long long outputMask = 0;
+	for(size_t i = 0; i < lines.size(); i++) {
+		unsigned long long flags = (lines[i].mode == OUTPUT) ? GPIO_V2_LINE_FLAG_OUTPUT 
+			: (GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_EDGE_RISING | GPIO_V2_LINE_FLAG_EDGE_FALLING);
+		if(lines[i].pud == PUD_UP) flags |= GPIO_V2_LINE_FLAG_BIAS_PULL_UP;
+		else if(lines[i].pud == PUD_DOWN) flags |= GPIO_V2_LINE_FLAG_BIAS_PULL_DOWN;
+		else flags |= GPIO_V2_LINE_FLAG_BIAS_DISABLED;
+		if(lines[i].mode == OUTPUT) outputMask |= 1ULL << i;
+		if(i == 0) {
+			config.flags = flags;
+			continue;
+		}
+		if(flags == config.flags) continue;
+		// Lines that differ from the first share an attribute per distinct set of flags.
+		unsigned a = 0;
+		while(a < config.num_attrs && config.attrs[a].attr.flags != flags) a++;
+		if(a == config.num_attrs) {
+			if(a == GPIO_V2_LINE_NUM_ATTRS_MAX - 1) {
+				log("Error", "Too many different GPIO line configurations for one request.");
+				return false;
+			}
+			config.attrs[a].attr.id = GPIO_V2_LINE_ATTR_ID_FLAGS;
+			config.attrs[a].attr.flags = flags;
+			config.num_attrs++;
+		}
+		config.attrs[a].mask |= 1ULL << i;
+	}
+	// Keep the outputs at their current levels across the new configuration.
+	struct gpio_v2_line_values current;
+	memset(&current, 0, sizeof(current));
+	if(request >= 0) {
+		current.mask = (requested == 64) ? ~0ULL : ((1ULL << requested) - 1);
+		if(ioctl(request, GPIO_V2_LINE_GET_VALUES_IOCTL, &current) < 0) current.bits = 0;
+	}
+	if(outputMask) {
+		struct gpio_v2_line_config_attribute & values = config.attrs[config.num_attrs++];
+		values.attr.id = GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES;
+		values.attr.values = current.bits & outputMask;
+		values.mask = outputMask;
+	}
+	if(request >= 0 && requested == lines.size()) {
+		if(ioctl(request, GPIO_V2_LINE_SET_CONFIG_IOCTL, &config) < 0) {
+			log("Error", "Could not reconfigure GPIO lines: " + string(strerror(errno)));
+			return false;
+		}
+	} else {
+		struct gpio_v2_line_request req;
+		memset(&req, 0, sizeof(req));
+		for(size_t i = 0; i < lines.size(); i++)
+			req.offsets[i] = lines[i].offset;
+		strncpy(req.consumer, "jacobian", sizeof(req.consumer) - 1);
+		req.config = config;
+		req.num_lines = lines.size();
+		req.event_buffer_size = 1024; // The most the kernel allows, to ride out bursts of fast edges.
+		if(request >= 0) close(request);
+		request = -1;
+		if(ioctl(chip, GPIO_V2_GET_LINE_IOCTL, &req) < 0) {
+			log("Error", "Could not request GPIO lines from " + path + ": " + string(strerror(errno)));
+			return false;
+		}
+		request = req.fd;
+		requested = lines.size();
+		eventsHeld = eventsUsed = 0;
+		fcntl(request, F_SETFL, fcntl(request, F_GETFL) | O_NONBLOCK);
+	}
+	dirty = false;
+	return true;
+}
+
+// Set a pin to input or output. Inputs report both edges.
+void ChardevGPIO::setMode(int pin, int mode) {
+	// A pin left to the PWM peripheral must not be requested as a GPIO line, so give up any it has.
+	if(mode == PWM_OUTPUT) {
+		if(pin < 0 || pin >= 64 || index[pin] < 0) return;
+		lines.erase(lines.begin() + index[pin]);
+		for(int p = 0; p < 64; p++) index[p] = -1;
+		for(size_t l = 0; l < lines.size(); l++) index[lines[l].pin] = l;
+		dirty = true;
+		return;
+	}
+	int i = lineOf(pin);
+	if(i < 0) return;
+	lines[i].mode = mode;
+	dirty = true;
+}
+
+// Set a pin's bias.
+void ChardevGPIO::setPud(int pin, int pud) {
+	int i = lineOf(pin);
+	if(i < 0) return;
+	lines[i].pud = pud;
+	dirty = true;
+}
+
+// Read a pin's level.
+int ChardevGPIO::read(int pin) {
+	if(pin < 0 || pin >= 64 || index[pin] < 0 || !commit()) return -1;
+	struct gpio_v2_line_values values;
+	values.bits = 0;
+	values.mask = 1ULL << index[pin];
+	if(ioctl(request, GPIO_V2_LINE_GET_VALUES_IOCTL, &values) < 0) return -1;
+	return (values.bits & values.mask) ? 1 : 0;
+}
+
+// Drive a pin.
+void ChardevGPIO::write(int pin, int value) {
+	if(pin < 0 || pin >= 64 || index[pin] < 0 || !commit()) return;
+	struct gpio_v2_line_values values;
+	values.mask = 1ULL << index[pin];
+	values.bits = (value) ? values.mask : 0;
+	ioctl(request, GPIO_V2_LINE_SET_VALUES_IOCTL, &values);
+}
+
+// Translate a mask of pin IDs to a mask of positions in the request.
+unsigned long long ChardevGPIO::toLineMask(unsigned long long pins) {
+	unsigned long long mask = 0;
+	for(; pins; pins &= pins - 1) {
+		int i = index[__builtin_ctzll(pins)];
+		if(i >= 0) mask |= 1ULL << i;
+	}
+	return mask;
+}
+
+/**
+ * Drive several pins at once with a single ioctl.
+ * 
+ * @params
+ * 	unsigned long long set: The pins (wiringPi IDs) to drive logic HIGH.
+ * 	unsigned long long clear: The pins (wiringPi IDs) to drive logic LOW.
+ */
+void ChardevGPIO::writeMask(unsigned long long set, unsigned long long clear) {
+	if(!commit()) return;
+	struct gpio_v2_line_values values;
+	values.bits = toLineMask(set);
+	values.mask = values.bits | toLineMask(clear);
+	if(values.mask) ioctl(request, GPIO_V2_LINE_SET_VALUES_IOCTL, &values);
+}
+
+// Return the descriptor that becomes readable when an input pin has an edge to report.
+int ChardevGPIO::edgeFd(void) {
+	commit();
+	return this->request;
+}
+
+/**
+ * Take the next input edge reported by the kernel, without blocking.
+ * 
+ * @params
+ * 	EdgeEvent edge (reference): Filled in with the edge, stamped by the kernel on CLOCK_MONOTONIC.
+ * @return true if there was an edge.
+ */
+bool ChardevGPIO::readEdge(EdgeEvent & edge) {
+	if(request < 0) return false;
+	// Events are read many at a time, so that fast edges do not cost a system call each.
+	if(eventsUsed == eventsHeld) {
+		events.resize(64 * sizeof(struct gpio_v2_line_event));
+		ssize_t got = ::read(request, events.data(), events.size());
+		eventsUsed = eventsHeld = 0;
+		if(got < (ssize_t)sizeof(struct gpio_v2_line_event)) return false;
+		eventsHeld = got - got % sizeof(struct gpio_v2_line_event);
+	}
+	struct gpio_v2_line_event event;
+	memcpy(&event, events.data() + eventsUsed, sizeof(event));
+	eventsUsed += sizeof(event);
+	edge.pin = -1;
+	for(Line & line : lines) {
+		if(line.offset == event.offset) edge.pin = line.pin;
+	}
+	edge.rising = (event.id == GPIO_V2_LINE_EVENT_RISING_EDGE);
+	edge.timestamp = event.timestamp_ns;
+	return true;
+}
+
+/**
+ * SimulatedGPIO constructor.
+ * 
+ * @params
+ * 	size_t capacity: How many of the latest writes to keep.
+ */
+SimulatedGPIO::SimulatedGPIO(size_t capacity) : levels(0), writes(max(capacity, (size_t)1)), head(0) {}
+
+bool SimulatedGPIO::init(void) {
+	return true;
+}
+
+void SimulatedGPIO::setMode(int /* pin */, int /* mode */) {
+	return;
+}
+
+// An input left to its pull resistor reads as the resistor pulls it.
+void SimulatedGPIO::setPud(int pin, int pud) {
+	if(pud == PUD_UP) levels.fetch_or(1ULL << pin, memory_order_relaxed);
+	else if(pud == PUD_DOWN) levels.fetch_and(~(1ULL << pin), memory_order_relaxed);
+}
+
+int SimulatedGPIO::read(int pin) {
+	return (levels.load(memory_order_relaxed) >> pin) & 1;
+}
+
+void SimulatedGPIO::write(int pin, int value) {
+	if(value) writeMask(1ULL << pin, 0);
+	else writeMask(0, 1ULL << pin);
+}
+
+/**
+ * Drive several pins at once, and stamp the write. Only one thread may write at a time, which is
+ * how the Controller uses a backend.
+ * 
+ * @params
+ * 	unsigned long long set: The pins to drive logic HIGH.
+ * 	unsigned long long clear: The pins to drive logic LOW.
+ */
+void SimulatedGPIO::writeMask(unsigned long long set, unsigned long long clear) {
+	long long now = monotonicNanos();
+	levels.store((levels.load(memory_order_relaxed) | set) & ~clear, memory_order_relaxed);
+	unsigned long long n = head.load(memory_order_relaxed);
+	writes[n % writes.size()] = { now, set, clear };
+	head.store(n + 1, memory_order_release);
+}
+
+/**
+ * Read back the writes made since a given one. Writes older than the ring are lost; the reader
+ * should come back well before capacity more writes have been made.
+ * 
+ * @params
+ * 	unsigned long long from: The number of the first write wanted (0 for the first ever made).
+ * 	vector<Write> out (reference): The writes are appended to this, oldest first.
+ * @return the number of the next write to ask for.
+ */
+unsigned long long SimulatedGPIO::getWrites(unsigned long long from, vector<Write> & out) {
+	unsigned long long end = head.load(memory_order_acquire);
+	if(end - from > writes.size()) from = end - writes.size();
+	for(unsigned long long n = from; n < end; n++) out.push_back(writes[n % writes.size()]);
+	return end;
+}
+
+/*******************
+Input capture
+/*******************/
+
+/**
+ * PulseDecoder constructor.
+ * 
+ * @params
+ * 	long long minimum: The shortest valid pulse width; anything shorter is a glitch (ns).
+ * 	long long maximum: The longest valid pulse width; anything longer is a lost edge (ns).
+ */
+PulseDecoder::PulseDecoder(long long minimum, long long maximum) {
+	this->minWidth = minimum;
+	this->maxWidth = maximum;
+	head = tail = 0;
+	overruns = 0;
+	sequence = 0;
+	latestWidth = latestFrame = latestTime = 0;
+}
+
+/**
+ * Take one edge of the channel. A falling edge after a rising edge completes a pulse.
+ * Only one thread may feed edges.
+ * 
+ * @params
+ * 	EdgeEvent edge (reference): The edge.
+ */
+void PulseDecoder::edge(const EdgeEvent & edge) {
+	if(edge.rising) {
+		lastRose = rose;
+		rose = edge.timestamp;
+		high = true;
+		return;
+	}
+	if(!high) return; // The capture started in the middle of a pulse, or an edge was lost.
+	high = false;
+	Pulse pulse;
+	pulse.width = edge.timestamp - rose;
+	pulse.frame = (lastRose >= 0) ? rose - lastRose : 0;
+	pulse.timestamp = edge.timestamp;
+	if(pulse.width < minWidth || pulse.width > maxWidth) return;
+	// Publish as the latest pulse...
+	sequence.fetch_add(1, memory_order_acq_rel);
+	latestWidth.store(pulse.width, memory_order_relaxed);
+	latestFrame.store(pulse.frame, memory_order_relaxed);
+	latestTime.store(pulse.timestamp, memory_order_relaxed);
+	sequence.fetch_add(1, memory_order_release);
+	// ...and queue it, unless the consumer has fallen a whole ring behind.
+	size_t h = head.load(memory_order_relaxed);
+	if(h - tail.load(memory_order_acquire) == CAPACITY) {
+		overruns.fetch_add(1, memory_order_relaxed);
+		return;
+	}
+	ring[h % CAPACITY] = pulse;
+	head.store(h + 1, memory_order_release);
+}
+
+/**
+ * Take the oldest queued pulse. Only one thread may consume.
+ * 
+ * @params
+ * 	Pulse pulse (reference): Filled in with the pulse.
+ * @return true if there was a pulse.
+ */
+bool PulseDecoder::pop(Pulse & pulse) {
+	size_t t = tail.load(memory_order_relaxed);
+	if(t == head.load(memory_order_acquire)) return false;
+	pulse = ring[t % CAPACITY];
+	tail.store(t + 1, memory_order_release);
+	return true;
+}
+
+/**
+ * Read the latest decoded pulse without consuming anything. Safe from any thread.
+ * 
+ * @params
+ * 	Pulse pulse (reference): Filled in with the pulse.
+ * @return true if a pulse has been decoded yet.
+ */
+bool PulseDecoder::latest(Pulse & pulse) {
+	unsigned before, after;
+	do {
+		before = sequence.load(memory_order_acquire);
+		pulse.width = latestWidth.load(memory_order_relaxed);
+		pulse.frame = latestFrame.load(memory_order_relaxed);
+		pulse.timestamp = latestTime.load(memory_order_relaxed);
+		atomic_thread_fence(memory_order_acquire);
+		after = sequence.load(memory_order_relaxed);
+	} while((before & 1) || before != after);
+	return before > 0;
+}
+
+// Return how many pulses were dropped because the ring was full.
+long long PulseDecoder::getOverruns(void) {
+	return overruns.load(memory_order_relaxed);
+}
+
+/**
+ * EdgeCounter constructor.
+ * 
+ * @params
+ * 	double edgesPerRevolution: Counted edges per turn of the shaft, for RPM.
+ * 	bool bothEdges: Count falling edges as well as rising ones, doubling the resolution.
+ */
+EdgeCounter::EdgeCounter(double edgesPerRevolution, bool bothEdges) {
+	this->edgesPerRevolution = edgesPerRevolution;
+	this->bothEdges = bothEdges;
+	for(size_t i = 0; i < HISTORY; i++) times[i] = 0;
+	count = 0;
+}
+
+// Count one edge. Only one thread may feed edges.
+void EdgeCounter::edge(const EdgeEvent & edge) {
+	if(!edge.rising && !bothEdges) return;
+	long long n = count.load(memory_order_relaxed);
+	times[n % HISTORY].store(edge.timestamp, memory_order_relaxed);
+	count.store(n + 1, memory_order_release);
+}
+
+// Return how many edges have been counted. Safe from any thread.
+long long EdgeCounter::getCount(void) {
+	return count.load(memory_order_acquire);
+}
+
+// Return the CLOCK_MONOTONIC time of the latest counted edge, or -1 if there is none (ns).
+long long EdgeCounter::getLastEdge(void) {
+	long long n = count.load(memory_order_acquire);
+	return (n > 0) ? times[(n - 1) % HISTORY].load(memory_order_relaxed) : -1;
+}
+
+/**
+ * Estimate the edge rate from the edges in the last window: the number of intervals between them
+ * over the time they span. It reads 0 once fewer than two edges are left in the window, so choose
+ * a window longer than two edges at the slowest speed that matters. Safe from any thread.
+ * 
+ * @params
+ * 	long long window: How far back to look (ns). Only the latest HISTORY / 2 edges are considered.
+ * 	long long now: The current CLOCK_MONOTONIC time, if the caller already has it (ns).
+ * @return the rate in edges per second.
+ */
+double EdgeCounter::getRate(long long window, long long now) {
+	if(now < 0) now = monotonicNanos();
+	while(true) {
+		long long n = count.load(memory_order_acquire);
+		if(n < 2) return 0;
+		long long newest = n - 1,
+			oldest = max(0LL, n - (long long)HISTORY / 2);
+		long long latest = times[newest % HISTORY].load(memory_order_relaxed);
+		if(latest < now - window) return 0;
+		// Binary search for the oldest edge still inside the window.
+		long long low = oldest, high = newest;
+		while(low < high) {
+			long long middle = (low + high) / 2;
+			if(times[middle % HISTORY].load(memory_order_relaxed) >= now - window) high = middle;
+			else low = middle + 1;
+		}
+		long long first = times[low % HISTORY].load(memory_order_relaxed);
+		// Once the count reaches oldest + HISTORY the producer may be rewriting oldest's slot, so try again.
+		atomic_thread_fence(memory_order_acquire);
+		if(count.load(memory_order_relaxed) - oldest >= (long long)HISTORY) continue;
+		if(low == newest || latest <= first) return 0;
+		return (double)(newest - low) * PWM::NANOS_PER_SECOND / (latest - first);
+	}
+}
+
+/**
+ * Estimate the shaft speed from the edges in the last window. See getRate().
+ * 
+ * @params
+ * 	long long window: How far back to look (ns).
+ * 	long long now: The current CLOCK_MONOTONIC time, if the caller already has it (ns).
+ * @return revolutions per minute.
+ */
+double EdgeCounter::getRPM(long long window, long long now) {
+	return getRate(window, now) * 60 / edgesPerRevolution;
+}
+
+/*******************
+Controller object
+/*******************/
+
+/**
+ * Controller constructor.
+ * 
+ * @params
+ * 	string name: The name of the controller.
+ * 	GPIOBackend gpio (pointer): The backend to access pins through, or nullptr for the default
+ * 	(wiringPi, or the memory-mapped registers when built without it). It must outlive the controller.
+ */
+Controller::Controller(string name, GPIOBackend * gpio) {
+	if(gpio == nullptr) {
+#ifndef JACOBIAN_NO_WIRINGPI
+		ownedGpio.reset(new WiringPiGPIO());
+#else
+		ownedGpio.reset(new MappedGPIO());
+#endif
+		gpio = ownedGpio.get();
+	}
+	this->gpio = gpio;
+	writesIssued = writesSkipped = readsIssued = readsSkipped = 0;
+	running = overriden = false;
+	resumedAt = lastResume = worstResume = 0;
+	for(int i = 0; i < 64; i++) sinks[i] = nullptr;
+	watched = 0;
+	capturing = false;
+	if(!init()) {
+		log("FATAL", "JacobianOS has encountered an error. See log.txt");
+		exit(-1);
+	}
+	setName(name);
+	setState(true);
+	log("Success", "JacobianOS successfully initialized.");
+}
+
+/**
+ * This function is called automatically when a new Controller is constructed.
+ * Its main purpose is to initiate the GPIO backend (wiringPi by default).
+ */
+bool Controller::init(void) {
+	return gpio->init();
+}
+
+/**
+ * This function MUST be called after every JacobianOS program. It resets the state of the
+ * configured GPIO pins to a neutral state. This is to avoid any electrical discharge
+ * or damage of componets after use.
+ */
+void Controller::kill(void) {
+	stopCapture();
+	HardwarePWM::disableAll();
+	for(pair<string, int> pin : pinout) {
+		PinHandle handle;
+		handle.id = pin.second;
+		setPin(handle, 0);
+		setPinMode(handle, INPUT);
+	}
+	log("Success", "Controller terminated. It is now safe to touch the electronic components.");
+	return;
+}
+
+// Return if the controller is currently overriden by manual controller.
+bool Controller::isOverridden(void) {
+	return this->overriden.load();
+}
+
+// Set the state of the Controller override. Taking control back wakes the output thread.
+void Controller::Override(bool verdict) {
+	{
+		lock_guard<mutex> lock(stateLock);
+		if(!verdict && this->overriden) resumedAt = monotonicNanos();
+		this->overriden = verdict;
+	}
+	stateChanged.notify_all();
+	recordFlight(FLIGHT_OVERRIDE, -1, verdict, 0);
+	if(verdict) log("Success", "The Controller is no longer in control of the RC car.");
+	else log("Success", "The Controller is now in direct control of the RC car.");
+	return;
+}
+
+/**
+ * Block the calling (output) thread, using no CPU, for as long as the controller is running and
+ * overriden. It returns as soon as control is taken back or the controller is stopped, and
+ * records how long that took.
+ */
+void Controller::waitForControl(void) {
+	unique_lock<mutex> lock(stateLock);
+	stateChanged.wait(lock, [this] { return !running || !overriden; });
+	long long requested = resumedAt.exchange(0);
+	if(requested > 0) {
+		long long latency = monotonicNanos() - requested;
+		lastResume = latency;
+		if(latency > worstResume) worstResume = latency;
+	}
+	return;
+}
+
+/**
+ * Read how long the output thread took to resume after control was last taken back.
+ * 
+ * @params
+ * 	long long last (reference): The latency of the last resume (ns).
+ * 	long long worst (reference): The worst resume latency so far (ns).
+ */
+void Controller::getResumeLatency(long long & last, long long & worst) {
+	last = lastResume.load();
+	worst = worstResume.load();
+	return;
+}
+
+// Return the distinct name of the Controller.
+string Controller::getName(void) {
+	return this->name;
+}
+
+// Set the name of the Controller.
+void Controller::setName(string name) {
+	this->name = name;
+	return;
+}
+
+// Set whether or not the Controller is on or off. Stopping wakes the output thread.
+void Controller::setState(bool state) {
+	{
+		lock_guard<mutex> lock(stateLock);
+		this->running = state;
+	}
+	stateChanged.notify_all();
+	recordFlight(FLIGHT_STATE, -1, state, 0);
+}
+
+// Is the controller on or off?
+bool Controller::isRunning(void) {
+	return this->running.load();
+}
+
+/**
+ * This function will return the pin ID of the current active pinouts by name.
+ * 
+ * @params
+ * 	string pinName: The name of the pin you are searching for.
+ * @return the integer pin ID from name if it exists, otherwise -1.
+ */
+int Controller::returnPinFromName(const string & pinName) {
+	for(const pair<string, int> & pin : this->pinout) {
+		if(pin.first == pinName)
+			return pin.second;
+	}
+	log("Error", "No pin was found with this name: " + pinName);
+	return -1;
+}
+
+/**
+ * This function will resolve a configured pin by name once, so it can be used without a search afterwards.
+ * 
+ * @params
+ * 	string pinName: The name of the pin you are searching for.
+ * @return a handle to the pin, which is not valid() if no pin has this name.
+ */
+PinHandle Controller::getPin(const string & pinName) {
+	PinHandle handle;
+	handle.id = returnPinFromName(pinName);
+	return handle;
+}
+
+/**
+ * This function will set the pin mode (see WiringPI pinMode for specfic modes) of the pin by name, if it exists.
+ * 
+ * @params
+ * 	string pinName: The name of the pin you are setting the mode for.
+ * 	int mode: The mode you would like to set.
+ */
+void Controller::setPinMode(const string & pinName, int mode) {
+	setPinMode(getPin(pinName), mode);
+	return; 
+}
+
+/**
+ * This function will set the pin pull up resistor (see WiringPi pud for specific states) of the pin by name, if it exists.
+ * 
+ * @params
+ * 	string pinName: The name of the pin you are setting the pull up for.
+ * 	int pud: The pull up mode you are setting it to.
+ */
+void Controller::setPinPud(const string & pinName, int pud) {
+	setPinPud(getPin(pinName), pud);
+	return;
+}
+
+/**
+ * This function will read the digital value of the current pin by name, if it exists.
+ * 
+ * @params
+ * 	string pinName: The name of the pin.
+ * @return the value of the pin.
+ */
+int Controller::readPin(const string & pinName) {
+	return readPin(getPin(pinName));
+}
+
+/**
+ * This function will set the digital value of the pin by name, if it exists.
+ * 
+ * @params
+ * 	string pinName: The name of the pin.
+ * 	int value: The digital value.
+ */
+void Controller::setPin(const string & pinName, int value) {
+	setPin(getPin(pinName), value);
+	return;
+}
+
+// Set the pin mode of a resolved pin (see setPinMode() by name).
+void Controller::setPinMode(PinHandle pin, int mode) {
+	if(!pin.valid()) return;
+	gpio->setMode(pin.id, mode);
+	if(pin.id < 64) {
+		unsigned long long bit = 1ULL << pin.id;
+		known &= ~bit; // The level after a mode change is whatever the hardware says.
+		outputs = (mode == OUTPUT) ? (outputs | bit) : (outputs & ~bit);
+	}
+	return;
+}
+
+// Set the pull resistor of a resolved pin (see setPinPud() by name).
+void Controller::setPinPud(PinHandle pin, int pud) {
+	if(!pin.valid()) return;
+	gpio->setPud(pin.id, pud);
+	return;
+}
+
+/**
+ * Read the digital value of a resolved pin (see readPin() by name). An output pin that the
+ * controller has written is answered from the shadow without touching the hardware.
+ * 
+ * @params
+ * 	PinHandle pin: The pin.
+ * @return the value of the pin, or -1 if it is not valid.
+ */
+int Controller::readPin(PinHandle pin) {
+	if(!pin.valid()) return -1;
+	if(pin.id < 64 && (outputs & known & (1ULL << pin.id))) {
+		readsSkipped.fetch_add(1, memory_order_relaxed);
+		return (levels >> pin.id) & 1;
+	}
+	readsIssued.fetch_add(1, memory_order_relaxed);
+	return gpio->read(pin.id);
+}
+
+/**
+ * Set the digital value of a resolved pin (see setPin() by name). A write of the level the
+ * pin already has is skipped.
+ * 
+ * @params
+ * 	PinHandle pin: The pin.
+ * 	int value: The digital value.
+ */
+void Controller::setPin(PinHandle pin, int value) {
+	if(!pin.valid()) return;
+	if(pin.id < 64) {
+		unsigned long long bit = 1ULL << pin.id;
+		if((known & bit) && ((levels & bit) != 0) == (value != 0)) {
+			writesSkipped.fetch_add(1, memory_order_relaxed);
+			return;
+		}
+		known |= bit;
+		levels = (value) ? (levels | bit) : (levels & ~bit);
+	}
+	writesIssued.fetch_add(1, memory_order_relaxed);
+	gpio->write(pin.id, value);
+	return;
+}
+
+/**
+ * This function will drive several pins at once by pin ID. Each set bit in the masks selects the pin
+ * with that ID, so one call can replace a run of setPin() calls on the same edge. Pins that are
+ * already at the requested level are left out, and if none are left the write is skipped.
+ * 
+ * @params
+ * 	unsigned long long set: The pins to drive logic HIGH.
+ * 	unsigned long long clear: The pins to drive logic LOW.
+ */
+void Controller::setPins(unsigned long long set, unsigned long long clear) {
+	set &= ~(known & levels);
+	clear &= ~(known & ~levels);
+	if(!(set | clear)) {
+		writesSkipped.fetch_add(1, memory_order_relaxed);
+		return;
+	}
+	known |= set | clear;
+	levels = (levels | set) & ~clear;
+	writesIssued.fetch_add(1, memory_order_relaxed);
+	gpio->writeMask(set, clear);
+	return;
+}
+
+// Return the descriptor that becomes readable when an input pin has an edge, or -1 if the backend has none.
+int Controller::getEdgeFd(void) {
+	return gpio->edgeFd();
+}
+
+// Take the next input edge from the backend, without blocking (see GPIOBackend::readEdge()).
+bool Controller::readEdge(EdgeEvent & edge) {
+	return gpio->readEdge(edge);
+}
+
+/**
+ * Deliver the edges of an input pin to a sink, from the controller's capture thread (started by
+ * the first call, so no thread runs until a pin is watched). Edges come from the backend's kernel
+ * event descriptor when it has one, and otherwise from sampling the watched pins, which is far
+ * coarser (see setPollInterval()). Configure every pin before watching any of them.
+ * 
+ * @params
+ * 	PinHandle pin: The input pin.
+ * 	EdgeSink sink (reference): Where the edges go. It must outlive the capture.
+ * @return true if the pin is being watched.
+ */
+bool Controller::watchEdges(PinHandle pin, EdgeSink & sink) {
+	if(!pin.valid() || pin.id >= 64) return false;
+	sinks[pin.id].store(&sink, memory_order_release);
+	watched.fetch_or(1ULL << pin.id, memory_order_acq_rel);
+	if(!capturing.exchange(true)) {
+		// Make the line request here, so the capture thread does not race the first write to make it.
+		gpio->edgeFd();
+		captureThread = thread(&Controller::captureLoop, this);
+	}
+	return true;
+}
+
+/**
+ * Hand an edge to the sink of its pin, if it has one. The capture thread calls this for every
+ * edge it sees; it may also be used to inject edges, such as a synthetic stream.
+ * 
+ * @params
+ * 	EdgeEvent edge (reference): The edge.
+ */
+void Controller::feedEdge(const EdgeEvent & edge) {
+	if(edge.pin < 0 || edge.pin >= 64) return;
+	EdgeSink * sink = sinks[edge.pin].load(memory_order_acquire);
+	if(sink != nullptr) sink->edge(edge);
+}
+
+// Stop the capture thread, if it is running.
+void Controller::stopCapture(void) {
+	if(!capturing.exchange(false)) return;
+	if(captureThread.joinable()) captureThread.join();
+}
+
+/**
+ * Set how often the watched pins are sampled when the backend cannot report edges. Sampling is a
+ * fallback with real limits: every sample wakes the capture thread, so the default of 20us costs
+ * 50,000 wakeups a second; an edge is only timed to within the interval plus the thread's wakeup
+ * latency; and a level held for less than that is missed, so a square wave is only followed
+ * reliably up to about a fifth of 1 / interval (10kHz at 20us), well short of a fast encoder.
+ * A longer interval saves CPU at the cost of all three. Call it before watching any pin.
+ * 
+ * @params
+ * 	long long interval: The time between samples (ns).
+ */
+void Controller::setPollInterval(long long interval) {
+	if(interval > 0) this->pollInterval = interval;
+	return;
+}
+
+// The capture thread. It runs until stopCapture().
+void Controller::captureLoop(void) {
+	int fd = gpio->edgeFd();
+	if(fd >= 0) {
+		struct pollfd events = { fd, POLLIN, 0 };
+		EdgeEvent edge;
+		while(capturing.load(memory_order_relaxed)) {
+			if(poll(&events, 1, 100) <= 0) continue; // Wake up now and then to notice a stop.
+			while(gpio->readEdge(edge)) feedEdge(edge);
+		}
+		return;
+	}
+	// The backend cannot report edges, so sample the watched pins on a fixed grid instead.
+	unsigned long long last = 0, seen = 0;
+	long long deadline = monotonicNanos();
+	while(capturing.load(memory_order_relaxed)) {
+		unsigned long long pins = watched.load(memory_order_acquire);
+		long long now = monotonicNanos();
+		for(unsigned long long rest = pins; rest; rest &= rest - 1) {
+			int pin = __builtin_ctzll(rest);
+			unsigned long long bit = 1ULL << pin;
+			bool high = (gpio->read(pin) == 1);
+			if((seen & bit) && high != ((last & bit) != 0)) {
+				EdgeEvent edge = { pin, high, now };
+				feedEdge(edge);
+			}
+			seen |= bit;
+			last = (high) ? (last | bit) : (last & ~bit);
+		}
+		deadline += pollInterval;
+		if(deadline < now) deadline = now + pollInterval;
+		waitUntil(deadline);
+	}
+}
+
+// Return how many pin accesses reached the hardware and how many were answered by the shadow.
+AccessCounters Controller::getAccessCounters(void) {
+	AccessCounters counters;
+	counters.writesIssued = writesIssued.load(memory_order_relaxed);
+	counters.writesSkipped = writesSkipped.load(memory_order_relaxed);
+	counters.readsIssued = readsIssued.load(memory_order_relaxed);
+	counters.readsSkipped = readsSkipped.load(memory_order_relaxed);
+	return counters;
+}
+
+/**
+ * This function will add and configure a new pinout on the controller.
+ * You must create a pin with this function in order to edit properties of the pin.
+ * 
+ * @params
+ * 	int id: The ID (location) of the pin (use $ gpio readall to find correct ID).
+ * 	string name: The name of the pin you can use as a unique reference.
+ * 	int mode: The default mode of the pin.
+ * 	int pud: The default pull resistor mode of the pin.
+ * @return a handle to the new pin.
+ */
+PinHandle Controller::configurePin(int id, string pinName, int mode, int pud) {
+	pair<string, int> pin = make_pair(pinName, id);
+	this->pinout.push_back(pin);
+	PinHandle handle;
+	handle.id = id;
+	setPinMode(handle, mode);
+	setPinPud(handle, pud);
+	log("Success", "A new pin has been configured! Pin ID: " 
+		+ to_string(id) + ", pinName: " + pinName + ".");
+	return handle;
+}
+	
+/*******************
+Pulse Width Modulation generator
+/*******************/
+
+// PWM constructor.
+PWM::PWM(int freq, double duty) {
+	static atomic<int> channels(0);
+	this->channel = channels.fetch_add(1);
+	this->latest = Profile();
+	this->latest.segments = 1;
+	for(int i = 0; i < 3; i++) profiles[i] = latest;
+	this->back = 0;
+	this->shared = 1;
+	this->front = 2;
+	this->frequency = freq;
+	this->period = NANOS_PER_SECOND / frequency;
+	this->periodStart = monotonicNanos();
+	this->on = false;
+	setDutyCycle(duty);
+	latch();
+}
+
+/**
+ * Set the duty cycle of the PWM signal. This is safe to call from any thread; the new
+ * duty cycle takes effect at the start of the next period.
+ * 
+ * @params
+ * 	double duty: The duty cycle [0.1% - 100%].
+ */
+void PWM::setDutyCycle(double duty) {
+	duty = (duty > 100.0f) ? 100.0f : duty;
+	duty = (duty <= 0.0f) ? 0.1f : duty;
+	chrono::nanoseconds high((long long)(period * (duty / 100.0)));
+	PulseSegment hold = { high, high, chrono::nanoseconds(0), RAMP_LINEAR };
+	sequencePulseWidth(&hold, 1);
+}
+
+/**
+ * Set the pulse width (the logic HIGH portion of each period) of the PWM signal directly, without a
+ * round trip through a duty cycle percentage. This is safe to call from any thread; the new pulse
+ * width takes effect at the start of the next period.
+ * 
+ * (ex: pwm.setPulseWidth(chrono::microseconds(1500)) for a centered servo)
+ * 
+ * @params
+ * 	chrono::nanoseconds width: The pulse width [0 - period]. Coarser durations convert implicitly.
+ */
+void PWM::setPulseWidth(chrono::nanoseconds width) {
+	PulseSegment hold = { width, width, chrono::nanoseconds(0), RAMP_LINEAR };
+	sequencePulseWidth(&hold, 1);
+}
+
+/**
+ * Ramp the pulse width from one value to another, starting now. The output thread works out the
+ * pulse width at the start of every period, so the ramp is as smooth as the PWM frequency allows
+ * and costs the calling thread nothing after this call. Once over, the ramp holds its last value.
+ * Any later setpoint replaces the ramp, even one still in progress.
+ * 
+ * (ex: pwm.rampPulseWidth(chrono::microseconds(1500), chrono::microseconds(2000), chrono::seconds(2)))
+ * 
+ * @params
+ * 	chrono::nanoseconds from: The pulse width to start from [0 - period].
+ * 	chrono::nanoseconds to: The pulse width to end on [0 - period].
+ * 	chrono::nanoseconds length: How long the ramp takes.
+ * 	int curve: The shape of the ramp, a RAMPCURVE.
+ */
+void PWM::rampPulseWidth(chrono::nanoseconds from, chrono::nanoseconds to, chrono::nanoseconds length, int curve) {
+	PulseSegment ramp = { from, to, length, curve };
+	sequencePulseWidth(&ramp, 1);
+}
+
+/**
+ * Run a timed sequence of ramps and holds, such as the pulses that arm an ESC for reverse. The output
+ * thread moves from one segment to the next on its own clock, so this returns at once and the calling
+ * thread never sleeps through the sequence. The last segment holds its end value once it is over.
+ * 
+ * A new profile normally pre-empts the one before it, even partway through. Queued instead, it waits
+ * for the segments still to run ahead of the current last one and replaces only that last one; so a
+ * new speed given while an ESC is being armed is taken up as soon as the arming is over. Writers take
+ * turns, so setpoints from several threads never interleave, but the output thread never waits for them.
+ * 
+ * (ex: PulseSegment arm[] = { { 1050us, 1050us, 1s, RAMP_LINEAR }, { 1500us, 1500us, 250ms, RAMP_LINEAR }, ... };)
+ * 
+ * @params
+ * 	PulseSegment segments (pointer): The segments, pulse widths clamped to [0 - period].
+ * 	int count: How many segments [1 - SEGMENTS]; any more are left out.
+ * 	bool queue: Queue the segments behind a sequence in progress instead of pre-empting it.
+ * @return the CLOCK_MONOTONIC time the last segment starts, when the sequence is over (ns), or -1 if there were no segments.
+ */
+long long PWM::sequencePulseWidth(const PulseSegment * list, int count, bool queue) {
+	if(count < 1) return -1;
+	lock_guard<mutex> lock(publishLock);
+	long long now = monotonicNanos();
+	int kept = 0;
+	long long old = latest.to[latest.segments - 1],
+		begin = now,
+		ahead = 0; // The length of the kept segments (ns).
+	if(queue) {
+		for(int i = 0; i < latest.segments - 1; i++) ahead += latest.length[i];
+		if(now < latest.start + ahead) {
+			kept = latest.segments - 1;
+			begin = latest.start;
+		} else ahead = 0;
+	}
+	count = min(count, SEGMENTS - kept);
+	long long length = 0, end = 0;
+	for(int i = 0; i < count; i++) {
+		end = min(max((long long)list[i].to.count(), 0LL), period);
+		length += max((long long)list[i].length.count(), 0LL);
+		latest.from[kept + i] = min(max((long long)list[i].from.count(), 0LL), period);
+		latest.to[kept + i] = end;
+		latest.length[kept + i] = max((long long)list[i].length.count(), 0LL);
+		latest.curve[kept + i] = list[i].curve;
+	}
+	latest.start = begin;
+	latest.segments = kept + count;
+	// Fill in the writers' slot and swap it into shared, taking back whichever slot was there.
+	profiles[back] = latest;
+	back = shared.exchange(back | FRESH, memory_order_acq_rel) & ~FRESH;
+	if(kept + count > 1) recordFlight(FLIGHT_SEQUENCE, channel, end, begin + ahead + length - now);
+	else if(length > 0) recordFlight(FLIGHT_RAMP, channel, end, length);
+	else if(end != old) recordFlight(FLIGHT_SETPOINT, channel, end, old);
+	return begin + ahead + length - latest.length[kept + count - 1];
+}
+
+/**
+ * Find out whether a sequence still has segments to run before its last one, the one it holds.
+ * 
+ * @return true if a sequence is in progress.
+ */
+bool PWM::inSequence(void) {
+	lock_guard<mutex> lock(publishLock);
+	long long ahead = 0;
+	for(int i = 0; i < latest.segments - 1; i++) ahead += latest.length[i];
+	return ahead > 0 && monotonicNanos() < latest.start + ahead;
+}
+
+/**
+ * Update the state of the PWM as time moves. This may be called every loop cycle, but it is
+ * only required at the times returned by nextEdge(); see waitForEdge().
+ */
+void PWM::tick(void) {
+	long long now = monotonicNanos(),
+		since = now - periodStart;
+	if(since >= period) {
+		periodStart += period;
+		// More than a period behind: start a fresh period rather than catching up.
+		if(now - periodStart >= period) periodStart = now;
+		since = now - periodStart;
+		latch(periodStart);
+	}
+	on = (since < highTime);
+}
+
+// Evaluate the current state of the PWM signal: logic HIGH or LOW.
+bool PWM::eval(void) {
+	return this->on;
+}
+
+/**
+ * Return the absolute time of the next edge of the signal, as of the last tick().
+ * 
+ * @return the CLOCK_MONOTONIC time of the next edge, in nanoseconds.
+ */
+long long PWM::nextEdge(void) {
+	return (on) ? periodStart + highTime : periodStart + period;
+}
+
+/**
+ * Sleep until the next edge of the signal, then tick. For a single channel this replaces
+ * calling tick() in an undelayed loop.
+ * 
+ * @params
+ * 	long long spin: How long before the edge to start spinning, in nanoseconds (see waitUntil()).
+ */
+void PWM::waitForEdge(long long spin) {
+	waitUntil(nextEdge(), spin);
+	tick();
+}
+
+// Return the length of one period of the signal (ns).
+long long PWM::getPeriod(void) {
+	return this->period;
+}
+
+// Return the length of the logic HIGH portion of the current period (ns).
+long long PWM::getHighTime(void) {
+	return this->highTime;
+}
+
+/**
+ * Pick up the most recently published setpoint, evaluating it if it is a ramp or sequence. This must
+ * only be called by the output thread, at the start of a period; tick() and PWMScheduler do so.
+ * 
+ * @params
+ * 	long long now: The CLOCK_MONOTONIC start of the period, to evaluate the profile at (ns). Read from the clock if not given.
+ * @return the length of the logic HIGH portion of the new period (ns).
+ */
+long long PWM::latch(long long now) {
+	// Take the fresh profile, if there is one, handing back the slot just finished with.
+	if(shared.load(memory_order_relaxed) & FRESH) front = shared.exchange(front, memory_order_acq_rel) & ~FRESH;
+	const Profile & profile = profiles[front];
+	int i = 0;
+	long long elapsed = 0;
+	// The clock is only read while the profile still changes with time.
+	if(profile.segments > 1 || profile.length[0] > 0) {
+		if(now < 0) now = monotonicNanos();
+		elapsed = now - profile.start;
+		// Skip the segments already over; the last one holds its end value.
+		for(; i < profile.segments - 1 && elapsed >= profile.length[i]; i++) elapsed -= profile.length[i];
+	}
+	long long from = profile.from[i], 
+		to = profile.to[i], 
+		length = profile.length[i];
+	int curve = profile.curve[i];
+	if(length <= 0) {
+		this->highTime = to;
+		return this->highTime;
+	}
+	double t = (double)elapsed / length;
+	t = (t < 0.0) ? 0.0 : (t > 1.0) ? 1.0 : t;
+	if(curve == RAMP_SMOOTH) t = t * t * (3.0 - 2.0 * t);
+	this->highTime = from + llround((to - from) * t);
+	return this->highTime;
+}
+
+// Return the channel number of the PWM, as it appears in flight recordings.
+int PWM::getChannel(void) {
+	return this->channel;
+}
+
+/*******************
+Telemetry
+/*******************/
+
+// Return the bucket of a value.
+int LatencyHistogram::bucketOf(long long value) {
+	if(value < SUBS) return (value < 0) ? 0 : (int)value;
+	int exponent = 63 - __builtin_clzll(value);
+	int bucket = (exponent - SUB_BITS + 1) * SUBS + (int)((value >> (exponent - SUB_BITS)) & (SUBS - 1));
+	return min(bucket, BUCKETS - 1);
+}
+
+// Return the smallest value that falls in a bucket.
+long long LatencyHistogram::lowerBound(int bucket) {
+	if(bucket < SUBS) return bucket;
+	int exponent = bucket / SUBS + SUB_BITS - 1;
+	return (long long)(SUBS + bucket % SUBS) << (exponent - SUB_BITS);
+}
+
+// Count one value (ns). Only one thread should record into a histogram, but any may read it.
+void LatencyHistogram::record(long long value) {
+	if(value < 0) value = 0;
+	buckets[bucketOf(value)].fetch_add(1, memory_order_relaxed);
+	if(value >= RANGE) overflows.fetch_add(1, memory_order_relaxed);
+	count.fetch_add(1, memory_order_relaxed);
+	total.fetch_add(value, memory_order_relaxed);
+	if((unsigned long long)value > worst.load(memory_order_relaxed))
+		worst.store(value, memory_order_relaxed);
+}
+
+// Empty the histogram.
+void LatencyHistogram::reset(void) {
+	for(int i = 0; i < BUCKETS; i++) buckets[i].store(0, memory_order_relaxed);
+	count.store(0, memory_order_relaxed);
+	total.store(0, memory_order_relaxed);
+	worst.store(0, memory_order_relaxed);
+	overflows.store(0, memory_order_relaxed);
+}
+
+/**
+ * Estimate a percentile from the buckets.
+ * 
+ * @params
+ * 	double fraction: The percentile as a fraction (e.g. 0.99).
+ * @return the largest value of the bucket the percentile falls in, or 0 if nothing was recorded.
+ */
+long long LatencyHistogram::percentile(double fraction) const {
+	unsigned long long seen = 0, all = 0;
+	for(int i = 0; i < BUCKETS; i++) all += buckets[i].load(memory_order_relaxed);
+	if(all == 0) return 0;
+	unsigned long long rank = (unsigned long long)ceil(fraction * all);
+	for(int i = 0; i < BUCKETS; i++) {
+		seen += buckets[i].load(memory_order_relaxed);
+		if(seen >= max(rank, 1ULL)) 
+			return min(lowerBound(i + 1) - 1, (long long)worst.load(memory_order_relaxed));
+	}
+	return worst.load(memory_order_relaxed);
+}
+
+// Return the mean of the recorded values, or 0 if there are none.
+long long LatencyHistogram::mean(void) const {
+	unsigned long long n = count.load(memory_order_relaxed);
+	return (n > 0) ? total.load(memory_order_relaxed) / n : 0;
+}
+
+/**
+ * Telemetry constructor. Creates (or takes over) the shared-memory segment and starts it empty.
+ * 
+ * @params
+ * 	string name: The POSIX shared-memory name of the segment.
+ */
+Telemetry::Telemetry(string name) {
+	this->name = name;
+	this->block = nullptr;
+	this->shared = false;
+	int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0644);
+	if(fd >= 0 && ftruncate(fd, sizeof(TelemetryBlock)) == 0) {
+		void * memory = mmap(nullptr, sizeof(TelemetryBlock), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if(memory != MAP_FAILED) {
+			block = (TelemetryBlock *)memory;
+			shared = true;
+		}
+	}
+	if(fd >= 0) close(fd);
+	if(!shared) {
+		log("Error", "Could not create telemetry segment " + name + ": " + string(strerror(errno)) + ". Telemetry stays private.");
+		block = new TelemetryBlock();
+	}
+	block->magic.store(0, memory_order_relaxed);
+	memset((void *)block, 0, sizeof(TelemetryBlock));
+	block->pid = getpid();
+	block->started = monotonicNanos();
+	block->magic.store(TelemetryBlock::MAGIC, memory_order_release);
+}
+
+// Telemetry destructor. The segment is removed, so readers see that JacobianOS has stopped.
+Telemetry::~Telemetry(void) {
+	if(shared) {
+		block->magic.store(0, memory_order_release);
+		munmap(block, sizeof(TelemetryBlock));
+		shm_unlink(name.c_str());
+	} else delete block;
+}
+
+// Return the block to publish into.
+TelemetryBlock & Telemetry::get(void) {
+	return *block;
+}
+
+// Return true if the block is in shared memory, where readers can see it.
+bool Telemetry::isShared(void) {
+	return this->shared;
+}
+
+/**
+ * Map the telemetry block of a running JacobianOS, read-only. Reading it never slows the writer.
+ * 
+ * @params
+ * 	string name: The POSIX shared-memory name of the segment.
+ * @return the block, or nullptr if there is no such segment or it is not ready yet.
+ */
+const TelemetryBlock * Telemetry::attach(string name) {
+	int fd = shm_open(name.c_str(), O_RDONLY, 0);
+	if(fd < 0) return nullptr;
+	struct stat status;
+	void * memory = MAP_FAILED;
+	if(fstat(fd, &status) == 0 && (size_t)status.st_size >= sizeof(TelemetryBlock))
+		memory = mmap(nullptr, sizeof(TelemetryBlock), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(memory == MAP_FAILED) return nullptr;
+	const TelemetryBlock * block = (const TelemetryBlock *)memory;
+	if(block->magic.load(memory_order_acquire) != TelemetryBlock::MAGIC) {
+		detach(block);
+		return nullptr;
+	}
+	return block;
+}
+
+// Unmap a block mapped by attach().
+void Telemetry::detach(const TelemetryBlock * block) {
+	if(block != nullptr) munmap((void *)block, sizeof(TelemetryBlock));
+}
+
+/*******************
+Multi-channel PWM scheduler
+/*******************/
+
+/**
+ * PWMScheduler constructor.
+ * 
+ * @params
+ * 	int freq: The frequency shared by every channel (hz).
+ * 	long long merge: Falling edges closer together than this are written at once (ns).
+ * 	long long spinTime: How long before each edge to start spinning (ns).
+ */
+PWMScheduler::PWMScheduler(int freq, long long merge, long long spinTime) {
+	this->frequency = freq;
+	this->period = PWM::NANOS_PER_SECOND / frequency;
+	this->coalesce = merge;
+	this->spin = spinTime;
+	// The first call to service() starts a period immediately.
+	this->periodStart = monotonicNanos() - period;
+	resetLateness();
+}
+
+/**
+ * Attach a PWM channel to a configured pin of the controller.
+ * 
+ * @params
+ * 	Controller c (reference): The controller the pin is configured on.
+ * 	string pinName: The name of the pin the signal is delivered to.
+ * 	PWM pwm (reference): The channel. Its frequency must match the scheduler's.
+ * @return true if the channel was attached.
+ */
+bool PWMScheduler::attach(Controller & c, string pinName, PWM & pwm) {
+	return attach(c, c.getPin(pinName), pwm);
+}
+
+/**
+ * Attach a PWM channel to a resolved pin. The pin's mode is set to match the way the signal is
+ * generated: PWM_OUTPUT, which only selects the pin's PWM ALT function and leaves the peripheral to
+ * the kernel driver, for a hardware channel, and OUTPUT for the software engine, whatever the pin
+ * was configured as before.
+ * 
+ * @params
+ * 	Controller c (reference): The controller the pin belongs to.
+ * 	PinHandle pin: The pin the signal is delivered to.
+ * 	PWM pwm (reference): The channel. Its frequency must match the scheduler's.
+ * @return true if the channel was attached.
+ */
+bool PWMScheduler::attach(Controller & c, PinHandle pin, PWM & pwm) {
+	if(!pin.valid() || pin.id >= 64) return false;
+	if(pwm.getPeriod() != this->period) {
+		log("Error", "PWM channel on pin " + to_string(pin.id) + " does not match the scheduler frequency of " 
+			+ to_string(frequency) + "hz.");
+		return false;
+	}
+	// Hand the channel to a hardware PWM channel if the pin has one that can be opened.
+	int chip, number;
+	if(!hardwareRoot.empty() && HardwarePWM::channelOf(pin.id, chip, number)) {
+		Offload offload;
+		offload.pwm = &pwm;
+		offload.hardware.reset(new HardwarePWM(chip, number, hardwareRoot));
+		if(offload.hardware->open()) {
+			c.setPinMode(pin, PWM_OUTPUT);
+			offload.hardware->update(period, pwm.latch());
+			offloaded.push_back(move(offload));
+			log("Success", "PWM channel on pin " + to_string(pin.id) + " is generated by hardware PWM channel " 
+				+ to_string(number) + ".");
+			return true;
+		}
+	}
+	c.setPinMode(pin, OUTPUT);
+	Channel channel = { &pwm, 1ULL << pin.id };
+	this->channels.push_back(channel);
+	this->risingMask |= channel.mask;
+	return true;
+}
+
+/**
+ * Set where hardware PWM channels are looked for by attach(). By default this is /sys/class/pwm.
+ * 
+ * @params
+ * 	string root: A directory laid out like /sys/class/pwm, or "" to generate every channel in software.
+ */
+void PWMScheduler::setHardwareRoot(string root) {
+	this->hardwareRoot = root;
+}
+
+/**
+ * Publish the cost and lateness of every edge to a telemetry block.
+ * 
+ * @params
+ * 	TelemetryBlock block (pointer): The block, or nullptr to stop publishing.
+ */
+void PWMScheduler::setTelemetry(TelemetryBlock * block) {
+	this->telemetry = block;
+}
+
+/**
+ * Snapshot every channel's pulse width and build this period's falling edge timeline.
+ * Called right after the rising edge, so the work is done while every pin is HIGH.
+ */
+void PWMScheduler::plan(void) {
+	for(Offload & offload : offloaded)
+		offload.hardware->update(period, offload.pwm->latch(risen));
+	timeline.clear();
+	for(Channel & channel : channels) {
+		long long high = channel.pwm->latch(risen);
+		if(high >= period) continue; // 100% duty, the pin stays HIGH into the next period.
+		Edge edge = { high, channel.mask };
+		timeline.push_back(edge);
+	}
+	sort(timeline.begin(), timeline.end(), 
+		[](const Edge & a, const Edge & b) { return a.offset < b.offset; });
+	// Merge coincident edges into the earliest of them.
+	size_t merged = 0;
+	for(size_t i = 0; i < timeline.size(); i++) {
+		if(merged > 0 && timeline[i].offset - timeline[merged - 1].offset <= coalesce)
+			timeline[merged - 1].clear |= timeline[i].clear;
+		else timeline[merged++] = timeline[i];
+	}
+	timeline.resize(merged);
+	next = 0;
+}
+
+/**
+ * Sleep until the next edge group of the attached channels and write it to the controller.
+ * This must be called in the output loop while the controller is active.
+ * 
+ * @params
+ * 	Controller c (reference): The controller the channels are attached to.
+ */
+void PWMScheduler::service(Controller & c) {
+	if(next < timeline.size()) {
+		long long deadline = risen + timeline[next].offset;
+		waitUntil(deadline, spin);
+		long long woke = (telemetry != nullptr) ? monotonicNanos() : 0;
+		c.setPins(0, timeline[next].clear);
+		long long written = monotonicNanos();
+		record(written - deadline);
+		if(telemetry != nullptr) telemetry->tickCost.record(written - woke);
+		next++;
+		return;
+	}
+	periodStart += period;
+	// If the loop was held up for more than a period, start a fresh period instead of catching up.
+	long long now = monotonicNanos();
+	if(now - periodStart >= period) periodStart = now;
+	waitUntil(periodStart, spin);
+	long long woke = (telemetry != nullptr) ? monotonicNanos() : 0;
+	c.setPins(risingMask, 0);
+	// A late rising edge delays the falling edges with it, so pulse widths stay exact.
+	risen = monotonicNanos();
+	record(risen - periodStart);
+	plan();
+	if(telemetry != nullptr) telemetry->tickCost.record(monotonicNanos() - woke);
+}
+
+/**
+ * Abandon the period in progress and start a fresh one on the next call to service(). Call this
+ * when the output loop was paused, so the edges it missed are not counted as late.
+ */
+void PWMScheduler::restart(void) {
+	next = timeline.size();
+	periodStart = monotonicNanos() - period;
+}
+
+// Account for one edge written late by lateness nanoseconds.
+void PWMScheduler::record(long long lateness) {
+	edges.fetch_add(1, memory_order_relaxed);
+	totalLateness.fetch_add(lateness, memory_order_relaxed);
+	if(lateness > worstLateness.load(memory_order_relaxed))
+		worstLateness.store(lateness, memory_order_relaxed);
+	if(telemetry != nullptr) telemetry->edgeLateness.record(lateness);
+}
+
+/**
+ * Read the edge lateness statistics: how long after its deadline each edge was actually written.
+ * This is the jitter the pins see, and it may be read from any thread.
+ * 
+ * @params
+ * 	long long count (reference): The number of edges written.
+ * 	long long mean (reference): The mean lateness (ns).
+ * 	long long worst (reference): The worst lateness (ns).
+ */
+void PWMScheduler::getLateness(long long & count, long long & mean, long long & worst) {
+	count = edges.load(memory_order_relaxed);
+	mean = (count > 0) ? totalLateness.load(memory_order_relaxed) / count : 0;
+	worst = worstLateness.load(memory_order_relaxed);
+}
+
+// Start a new lateness measurement.
+void PWMScheduler::resetLateness(void) {
+	edges.store(0, memory_order_relaxed);
+	totalLateness.store(0, memory_order_relaxed);
+	worstLateness.store(0, memory_order_relaxed);
 }
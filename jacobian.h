@@ -6,6 +6,9 @@
  * @since 1.0.0
  */
 
+#ifndef JACOBIAN_H
+#define JACOBIAN_H
+
 #include <bits/stdc++.h>
 #include <iostream>
 #include <vector>
@@ -13,9 +16,24 @@
 #include <utility>
 #include <time.h>
 #include <thread>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
 using namespace std;
 
-#define VERSION "1.4.0"
+#define VERSION "1.5.0"
+
+// Build with -DJACOBIAN_NO_WIRINGPI to leave out wiringPi (the memory-mapped backend is used instead).
+// These are wiringPi's pin mode and pull resistor values, which the Controller API is written in.
+#ifdef JACOBIAN_NO_WIRINGPI
+#define INPUT 0
+#define OUTPUT 1
+#define PUD_OFF 0
+#define PUD_DOWN 1
+#define PUD_UP 2
+#define PWM_OUTPUT 2
+#endif
 
 /**
 * The Jacobian namespace encapsulates three main deliniations of tools: general utilities, 
@@ -57,41 +75,578 @@ namespace jacobian {
 		void log(T);
 	float timeToDutyCycle(int, float);
 	void waitForSeconds(double);
+	long long monotonicNanos(void);
+	void waitUntil(long long, long long = 0);
+
+	/**
+	 * The real-time settings that makeRealtime() managed to apply to the calling thread.
+	 * Each one is optional; a missing privilege leaves the flag false and the program runs on.
+	 * 
+	 * @since 1.5.0
+	 */
+	struct RealtimeStatus {
+		bool pinned = false, // Is the thread pinned to its CPU?
+			fifo = false, // Is the thread running under SCHED_FIFO?
+			locked = false; // Is the process memory locked and pre-faulted?
+	};
+	RealtimeStatus makeRealtime(int, int);
 	vector<string> tokenize(string, char);
+
+	/*******************
+	Logging
+	/*******************/
+
+	/**
+	 * Messages are formatted by the caller into a fixed-size record, which is pushed into a
+	 * lock-free ring with a monotonic timestamp and the id of its tag. A background thread
+	 * drains the ring to the console and to a rotating log file, so a log call never waits on
+	 * the terminal or the disk. When the ring is full the new message is dropped and counted,
+	 * and the drain thread reports how many were lost. Messages tagged "FATAL" are never
+	 * dropped: they are written out synchronously, along with everything queued before them.
+	 * 
+	 * @since 1.5.0
+	 */
+	static const size_t LOG_TEXT = 200; // The longest message kept, in characters; the rest is cut.
+	void logRecord(const char *, const char *, size_t);
+	void flushLog(void);
+	void setLogFile(string, long long = 1000000);
+	void setLogConsole(bool);
+	long long getLogDrops(void);
+
+	// Format a log argument into out, without allocating for strings and numbers.
+	template <typename T>
+	size_t logFormat(char * out, size_t size, const T & obj) {
+		if constexpr (is_convertible_v<const T &, string_view>) {
+			string_view text(obj);
+			size_t length = min(text.size(), size);
+			memcpy(out, text.data(), length);
+			return length;
+		} else if constexpr (is_same_v<T, char>) {
+			out[0] = obj;
+			return 1;
+		} else if constexpr (is_integral_v<T>) {
+			return to_chars(out, out + size, obj).ptr - out;
+		} else if constexpr (is_floating_point_v<T>) {
+			return min((size_t)max(snprintf(out, size, "%f", (double)obj), 0), size - 1);
+		} else {
+			ostringstream text;
+			text << obj;
+			return logFormat(out, size, text.str());
+		}
+	}
+
+	// General logging. These methods queue a simple message for the terminal and the log file.
+	template <typename T>
+	void log(string tag, T obj) {
+		char text[LOG_TEXT];
+		logRecord(tag.c_str(), text, logFormat(text, sizeof(text), obj));
+		return;
+	}
+	template <typename T>
+	void log(T obj) {
+		char text[LOG_TEXT];
+		logRecord(nullptr, text, logFormat(text, sizeof(text), obj));
+		return;
+	}
+
+	/*******************
+	Flight recorder
+	/*******************/
+
+	/**
+	 * The kinds of event the flight recorder keeps, and what their a and b fields hold.
+	 * 
+	 * @since 1.5.0
+	 */
+	enum FLIGHTEVENT {
+		FLIGHT_COMMAND = 1, // A command line; a and b hold its first 16 characters.
+		FLIGHT_SETPOINT = 2, // A PWM setpoint change on channel; a is the new pulse width, b the old one (ns).
+		FLIGHT_OVERRIDE = 3, // The override was set (a = 1) or released (a = 0).
+		FLIGHT_STATE = 4, // The controller started (a = 1) or stopped (a = 0).
+		FLIGHT_RAMP = 5, // A PWM ramp on channel; a is the pulse width it ends on, b its length (ns).
+		FLIGHT_SEQUENCE = 6 // A PWM sequence on channel; a is the pulse width it ends on, b how long until it gets there (ns).
+	};
+
+	// One recorded event, 40 bytes.
+	struct FlightRecord {
+		atomic<unsigned long long> sequence; // The record's number plus one, written last; stale while incomplete.
+		long long time; // CLOCK_MONOTONIC time of the event (ns).
+		unsigned type; // A FLIGHTEVENT.
+		int channel; // The PWM channel, or -1.
+		long long a, b;
+	};
+
+	// The start of a recording file. The records follow it at FlightHeader::SIZE bytes in.
+	struct FlightHeader {
+		static const unsigned long long MAGIC = 0x4a464c4947485431ULL; // "JFLIGHT1"
+		static const size_t SIZE = 64;
+		unsigned long long magic;
+		unsigned version, recordSize;
+		unsigned long long capacity; // Records the ring holds.
+		atomic<unsigned long long> head; // Records ever claimed; the next one goes at head % capacity.
+		long long monotonic, realtime; // The clocks when the file was made, to line records up with wall time (ns).
+	};
+
+	/**
+	 * An always-on binary flight recorder. Events go into a circular buffer in a memory-mapped file,
+	 * so they are in the page cache the moment they are written and survive the process crashing.
+	 * Recording claims a slot with one atomic add and fills it in; it takes no locks and makes no
+	 * system calls. A recording is read back with the jacobiandecode tool.
+	 * 
+	 * @since 1.5.0
+	 */
+	class FlightRecorder {
+		private:
+			string path;
+			FlightHeader * header;
+			FlightRecord * records;
+			size_t bytes; // Size of the mapping.
+
+		public:
+			FlightRecorder(string = "flight.bin", unsigned long long = 65536);
+			~FlightRecorder(void);
+			bool isOpen(void);
+			void record(unsigned, int, long long, long long, long long = -1);
+			void command(string_view, long long = -1);
+			static void install(FlightRecorder *);
+	};
+	void recordFlight(unsigned, int, long long, long long);
 	
 	/*******************
 	Pulse Width Modulation generator
 	/*******************/
 
+	/**
+	 * The shapes of a PWM ramp.
+	 * 
+	 * @since 1.5.0
+	 */
+	enum RAMPCURVE {
+		RAMP_LINEAR = 0, // Constant rate of change.
+		RAMP_SMOOTH = 1 // Eases in and out (smoothstep), with no jump in the rate at either end.
+	};
+
+	/**
+	 * One segment of a PWM pulse width profile: a ramp from one pulse width to another, or a hold
+	 * when the two are the same. The last segment of a profile holds its end value once it is over.
+	 * 
+	 * @since 1.5.0
+	 */
+	struct PulseSegment {
+		chrono::nanoseconds from, to, length;
+		int curve; // A RAMPCURVE.
+	};
+
 	/**
 	 * This object creates a Pulse Width Modulation signal at specified frequency
-	 * and duty cycle. It operates soley by the change in the internal PI clock, so the mathematics
-	 * are done with the hope that the ticks are not delayed.
+	 * and duty cycle. It is driven by the monotonic (wall) clock in nanoseconds, and it knows the
+	 * absolute time of its next edge, so the caller can sleep until that edge instead of polling.
+	 * 
+	 * The duty cycle may be set from any thread. A new setpoint is published through a triple buffer
+	 * and is only picked up by the output thread at the start of a period, so a pulse is never
+	 * cut short or stretched by a change that lands mid-period. Writers take a lock (publishLock)
+	 * to take turns with each other; only latch(), on the output thread, is lock-free, and it never
+	 * waits on a writer, even one that was preempted halfway through publishing.
+	 * 
+	 * A setpoint may also be a ramp from one pulse width to another over a length of time, or a
+	 * timed sequence of ramps and holds. The output thread evaluates it afresh at the start of every
+	 * period, so a single call gives a smooth profile, or a whole timed sequence such as arming an
+	 * ESC, with nothing more asked of the calling thread.
 	 * 
 	 * @since 1.1.0
 	 */
 	class PWM {
+		public:
+			static const int SEGMENTS = 8; // The most segments a profile may have.
+
 		private:
 			// Data members.
 			bool on; // Is the PWM currently producing a logic HIGH or LOW?
 			int frequency; // (hz)
-			double dutyCycle; // (%)
-			// Internal clock state.
-			clock_t now = clock(), 
-				last, delta = 0, precisionSince,
-				precisionPeriod;
+			int channel; // Numbers the PWM objects in order of creation, for the flight recorder.
+			// A setpoint as a profile of segments. A fixed pulse width is one segment of length 0.
+			struct Profile {
+				int segments; // How many segments are in use [1 - SEGMENTS].
+				long long start; // CLOCK_MONOTONIC start of the first segment (ns).
+				long long from[SEGMENTS], to[SEGMENTS], // Pulse widths (ns).
+					length[SEGMENTS]; // (ns)
+				int curve[SEGMENTS]; // RAMPCURVEs.
+			};
+			static const int FRESH = 4; // Set in shared while its slot holds a profile the output thread has not taken.
+			// The latest setpoint, written by any thread, triple buffered. Writers take turns to fill in
+			// their slot and swap it into shared; the output thread swaps its own slot for shared whenever
+			// that holds a fresh profile. Each side only ever touches the slot it owns.
+			Profile profiles[3];
+			atomic<int> shared; // The slot between the two sides, plus FRESH.
+			int back, // The writers' slot (under publishLock).
+				front; // The output thread's slot.
+			Profile latest; // The profile last published (under publishLock).
+			mutex publishLock; // Held by writers only.
+			// Internal clock state (CLOCK_MONOTONIC, nanoseconds), owned by the output thread.
+			long long periodStart, // Absolute time of the current rising edge.
+				period, // Length of one period.
+				highTime; // Length of the logic HIGH portion of the current period.
 		public:
-			const int PRECISION = pow(10, (float)MEGA); // The amount of decimal precision of the PWM clock.
+			// Ticks per second of the PWM clock, which counts nanoseconds. Before 1.5.0 it counted microseconds
+			// and this was the member PRECISION (1e6); the new name stops old code that scaled by it from building.
+			static const long long NANOS_PER_SECOND = 1000000000LL;
 			PWM(int, double);
 			void setDutyCycle(double);
+			void setPulseWidth(chrono::nanoseconds);
+			void rampPulseWidth(chrono::nanoseconds, chrono::nanoseconds, chrono::nanoseconds, int = 0);
+			long long sequencePulseWidth(const PulseSegment *, int, bool = false);
+			bool inSequence(void);
 			void tick(void);
 			bool eval(void);
+			long long nextEdge(void);
+			void waitForEdge(long long = 0);
+			long long getPeriod(void);
+			long long getHighTime(void);
+			long long latch(long long = -1);
+			int getChannel(void);
 	};
-	
+
+	/**
+	 * A PWM channel specialized at compile time on its frequency and timebase (ticks per second).
+	 * The period is a constant, and setHighTime() takes integer ticks, so a setpoint computed in the
+	 * caller's own units is published without any floating point. Setpoints, ramps and sequences go
+	 * through the same handoff as PWM, and it attaches to a PWMScheduler like any other channel.
+	 * 
+	 * (ex: FixedPWM<60, 1000000> servo(timeToDutyCycle(60, radixShift(1.5, MILLI))); for a 60hz servo in microseconds)
+	 * 
+	 * @since 1.5.0
+	 */
+	template <int FREQUENCY, long long TIMEBASE = PWM::NANOS_PER_SECOND>
+	class FixedPWM : public PWM {
+		public:
+			static_assert(FREQUENCY > 0 && TIMEBASE >= FREQUENCY, "FixedPWM needs at least one tick per period.");
+			static_assert(PWM::NANOS_PER_SECOND % TIMEBASE == 0, "FixedPWM timebase must divide one second in nanoseconds.");
+			static constexpr int HZ = FREQUENCY;
+			static constexpr long long PERIOD = TIMEBASE / FREQUENCY; // (ticks)
+			static constexpr long long NANOS_PER_TICK = PWM::NANOS_PER_SECOND / TIMEBASE;
+			static constexpr long long PERIOD_NANOS = PERIOD * NANOS_PER_TICK;
+
+			FixedPWM(double duty) : PWM(FREQUENCY, duty) {}
+
+			// Set the length of the logic HIGH portion of a period in ticks [0 - PERIOD]. Safe from any thread.
+			void setHighTime(long long ticks) {
+				ticks = (ticks > PERIOD) ? PERIOD : ticks;
+				ticks = (ticks < 0) ? 0 : ticks;
+				setPulseWidth(chrono::nanoseconds(ticks * NANOS_PER_TICK));
+				return;
+			}
+
+			// Return the length of the logic HIGH portion of the current period in ticks.
+			long long getHighTicks(void) { return getHighTime() / NANOS_PER_TICK; }
+	};
+
+	/**
+	 * A hardware PWM channel driven through the kernel PWM subsystem (/sys/class/pwm), so the signal
+	 * costs no CPU at all. The period and duty cycle are written in nanoseconds, and only the files
+	 * whose value changed are written. The sysfs root may point at an ordinary directory tree laid out
+	 * like /sys/class/pwm, so the writes can be inspected on any machine.
+	 * 
+	 * On a Pi the pin must be muxed to the PWM peripheral (dtoverlay=pwm-2chan, or pin mode PWM_OUTPUT,
+	 * which PWMScheduler::attach() sets; every backend only selects the pin's ALT function for it and
+	 * leaves the PWM clock and registers to the kernel driver).
+	 * 
+	 * Every open channel is listed, so disableAll() can stop them all when the controller is killed
+	 * or the program exits, even on a path that skips the destructors.
+	 * 
+	 * @since 1.5.0
+	 */
+	class HardwarePWM {
+		private:
+			string root, // The sysfs PWM class directory.
+				channelPath; // The exported channel directory.
+			int chip, channel;
+			int periodFd = -1, dutyFd = -1, enableFd = -1;
+			long long period = -1, highTime = -1; // What the files hold now (ns), or -1 if unknown.
+			atomic<bool> enabled;
+
+			bool put(int, long long);
+			static mutex & openLock(void);
+			static vector<HardwarePWM *> & opened(void);
+
+		public:
+			HardwarePWM(int, int, string = "/sys/class/pwm");
+			~HardwarePWM(void);
+			bool open(void);
+			void update(long long, long long);
+			void disable(void);
+			static void disableAll(void);
+			static bool channelOf(int, int &, int &);
+	};
+
+	/*******************
+	GPIO backends
+	/*******************/
+
+	/**
+	 * A level change seen on an input pin, stamped by whoever saw it first.
+	 * 
+	 * @since 1.5.0
+	 */
+	struct EdgeEvent {
+		int pin; // The wiringPi pin ID.
+		bool rising; // Did the pin go from logic LOW to HIGH?
+		long long timestamp; // CLOCK_MONOTONIC time of the edge (ns).
+	};
+
+	/**
+	 * A GPIO backend is what the Controller uses to touch the hardware. Pins are always addressed
+	 * by wiringPi pin ID, and modes and pull resistors use the wiringPi constants, whatever the
+	 * backend does underneath. A backend that can detect input edges by itself exposes them
+	 * through a file descriptor that becomes readable when readEdge() has something to return.
+	 * 
+	 * @since 1.5.0
+	 */
+	class GPIOBackend {
+		public:
+			virtual ~GPIOBackend(void) {}
+			virtual bool init(void) = 0;
+			virtual void setMode(int, int) = 0;
+			virtual void setPud(int, int) = 0;
+			virtual int read(int) = 0;
+			virtual void write(int, int) = 0;
+			virtual void writeMask(unsigned long long, unsigned long long);
+			virtual int edgeFd(void) { return -1; }
+			virtual bool readEdge(EdgeEvent &) { return false; }
+	};
+
+#ifndef JACOBIAN_NO_WIRINGPI
+	/**
+	 * The wiringPi backend, and the default. Every access is a wiringPi call.
+	 * 
+	 * @since 1.5.0
+	 */
+	class WiringPiGPIO : public GPIOBackend {
+		public:
+			bool init(void);
+			void setMode(int, int);
+			void setPud(int, int);
+			int read(int);
+			void write(int, int);
+	};
+#endif
+
+	/**
+	 * The memory-mapped backend maps the BCM2835 GPIO register block (/dev/gpiomem) and reads
+	 * and writes the registers directly. A whole edge of the PWM scheduler becomes one store to
+	 * GPSET0 or GPCLR0. The register block may also be mapped from an ordinary file (it is grown
+	 * to a full block if needed), so the register writes can be inspected on any machine.
+	 * 
+	 * @since 1.5.0
+	 */
+	class MappedGPIO : public GPIOBackend {
+		public:
+			// Register offsets in 32-bit words from the start of the block.
+			static const int GPFSEL0 = 0, GPSET0 = 7, GPCLR0 = 10, GPLEV0 = 13, 
+				GPPUD = 37, GPPUDCLK0 = 38;
+			static const size_t BLOCK_SIZE = 4096;
+
+		private:
+			string path;
+			int fd = -1;
+			volatile uint32_t * registers = nullptr;
+
+		public:
+			MappedGPIO(string = "/dev/gpiomem");
+			~MappedGPIO(void);
+			bool init(void);
+			void setMode(int, int);
+			void setPud(int, int);
+			int read(int);
+			void write(int, int);
+			void writeMask(unsigned long long, unsigned long long);
+			volatile uint32_t * getRegisters(void);
+			static int toBCM(int);
+			static int pwmFunction(int);
+	};
+
+	/**
+	 * The character device backend uses the Linux GPIO uAPI (v2) on /dev/gpiochipN, which replaces
+	 * the deprecated sysfs and needs no wiringPi. Every configured pin is requested in one batch,
+	 * a whole mask of outputs is written with one ioctl, and input pins report their edges with
+	 * kernel timestamps through an epoll-able descriptor (edgeFd()), so they need not be polled.
+	 * The line request is (re)made on the first access after the configuration changes, so configure
+	 * every pin before waiting on edgeFd(). Any chip works, including gpio-sim and gpio-mockup ones.
+	 * 
+	 * @since 1.5.0
+	 */
+	class ChardevGPIO : public GPIOBackend {
+		private:
+			struct Line {
+				int pin; // The wiringPi pin ID.
+				unsigned offset; // The line on the chip.
+				int mode = 0, pud = 0; // INPUT, PUD_OFF
+			};
+			string path;
+			bool translate; // Translate wiringPi pin IDs to BCM line offsets?
+			int chip = -1, // The chip descriptor.
+				request = -1; // The line request descriptor (also the edge descriptor).
+			atomic<bool> dirty; // Has the configuration changed since the request was made?
+			mutex commitLock; // Held while the request is made, which both the output and capture threads may do.
+			size_t requested = 0; // How many lines the current request covers.
+			vector<Line> lines;
+			int index[64]; // Position in lines of each pin ID, or -1.
+			vector<char> events; // Edge events read from the kernel in one batch.
+			size_t eventsHeld = 0, eventsUsed = 0; // Bytes of events in the batch, and bytes handed out.
+
+			int lineOf(int);
+			bool commit(void);
+			unsigned long long toLineMask(unsigned long long);
+
+		public:
+			ChardevGPIO(string = "/dev/gpiochip0", bool = true);
+			~ChardevGPIO(void);
+			bool init(void);
+			void setMode(int, int);
+			void setPud(int, int);
+			int read(int);
+			void write(int, int);
+			void writeMask(unsigned long long, unsigned long long);
+			int edgeFd(void);
+			bool readEdge(EdgeEvent &);
+	};
+
+	/**
+	 * The simulated backend touches no hardware at all, so JacobianOS can run and be measured on any
+	 * Linux machine. Pin levels are kept in memory (inputs read as their pull resistor leaves them)
+	 * and every write is stamped with the time it was made and kept in a ring of the last capacity
+	 * writes, where another thread may read them back with getWrites() while the writer carries on.
+	 * 
+	 * @since 1.5.0
+	 */
+	class SimulatedGPIO : public GPIOBackend {
+		public:
+			// One write to the pins, as a pair of masks by wiringPi pin ID.
+			struct Write {
+				long long timestamp; // CLOCK_MONOTONIC time of the write (ns).
+				unsigned long long set, clear; // The pins driven logic HIGH and LOW.
+			};
+
+		private:
+			atomic<unsigned long long> levels;
+			vector<Write> writes;
+			atomic<unsigned long long> head; // How many writes have been made.
+
+		public:
+			SimulatedGPIO(size_t = 1 << 20);
+			bool init(void);
+			void setMode(int, int);
+			void setPud(int, int);
+			int read(int);
+			void write(int, int);
+			void writeMask(unsigned long long, unsigned long long);
+			unsigned long long getWrites(unsigned long long, vector<Write> &);
+	};
+
 	/*******************
 	Controller object
 	/*******************/
 
+	/**
+	 * A pre-resolved reference to a configured pin, returned by Controller::configurePin().
+	 * Pin operations through a handle skip the search by name and allocate nothing, so the
+	 * handle is what the output loop should hold on to.
+	 * 
+	 * @since 1.5.0
+	 */
+	struct PinHandle {
+		int id = -1; // The pin ID, or -1 if the pin was not found.
+		bool valid(void) const { return id >= 0; }
+	};
+
+	/*******************
+	Input capture
+	/*******************/
+
+	/**
+	 * Anything that wants the edges of a watched input pin (see Controller::watchEdges()).
+	 * edge() is called from the controller's capture thread, so it must be quick and must not block.
+	 * 
+	 * @since 1.5.0
+	 */
+	class EdgeSink {
+		public:
+			virtual ~EdgeSink(void) {}
+			virtual void edge(const EdgeEvent &) = 0;
+	};
+
+	/**
+	 * Decodes the servo-style pulses of an RC receiver channel from its edges. Each pulse width
+	 * (rising to falling edge) that falls in the valid range is pushed into a lock-free ring for a
+	 * consumer to drain, and is also published as the latest pulse, which any thread may read at any
+	 * time. Edges may come from a watched pin or be fed in directly, e.g. from a synthetic stream.
+	 * 
+	 * @since 1.5.0
+	 */
+	class PulseDecoder : public EdgeSink {
+		public:
+			struct Pulse {
+				long long width, // Rising to falling edge (ns).
+					frame, // Rising edge to rising edge, or 0 for the first pulse (ns).
+					timestamp; // CLOCK_MONOTONIC time of the falling edge (ns).
+			};
+			static const size_t CAPACITY = 64; // Pulses the ring holds (a power of two).
+
+		private:
+			long long minWidth, maxWidth; // Valid pulse widths (ns).
+			long long rose = -1, lastRose = -1; // Rising edge times, owned by the producer.
+			bool high = false; // Is a pulse in progress?
+			Pulse ring[CAPACITY];
+			atomic<size_t> head, tail; // Written by the producer and the consumer respectively.
+			atomic<long long> overruns; // Pulses dropped because the ring was full.
+			// The latest pulse, published under a sequence counter (odd while it is being written).
+			atomic<unsigned> sequence;
+			atomic<long long> latestWidth, latestFrame, latestTime;
+
+		public:
+			PulseDecoder(long long = 500000, long long = 2500000);
+			void edge(const EdgeEvent &);
+			bool pop(Pulse &);
+			bool latest(Pulse &);
+			long long getOverruns(void);
+	};
+
+	/**
+	 * Counts the edges of a wheel encoder or tachometer pin and estimates their rate. The count is
+	 * a single atomic, and the rate is worked out by the reader from a ring of the latest edge
+	 * times, so sampling either takes no locks and never holds up the capture thread.
+	 * 
+	 * @since 1.5.0
+	 */
+	class EdgeCounter : public EdgeSink {
+		public:
+			static const size_t HISTORY = 256; // Edge times kept for rate estimates (a power of two).
+
+		private:
+			double edgesPerRevolution;
+			bool bothEdges; // Count falling edges as well as rising ones?
+			atomic<long long> times[HISTORY]; // Time of each counted edge, indexed by its count.
+			atomic<long long> count;
+
+		public:
+			EdgeCounter(double = 1, bool = false);
+			void edge(const EdgeEvent &);
+			long long getCount(void);
+			long long getLastEdge(void);
+			double getRate(long long, long long = -1);
+			double getRPM(long long, long long = -1);
+	};
+
+	/**
+	 * Counts of hardware pin accesses the Controller issued, and of those it answered from its
+	 * shadow of the output levels instead.
+	 * 
+	 * @since 1.5.0
+	 */
+	struct AccessCounters {
+		long long writesIssued = 0, writesSkipped = 0,
+			readsIssued = 0, readsSkipped = 0;
+	};
+
 	/**
 	 *	The Jacobian controller class defines a controller with software configured GPIO
 	 * outputs or inputs. A controller is defined by name, and it's pins by ID.
@@ -103,29 +658,66 @@ namespace jacobian {
 	class Controller {
 		private:
 			// Data members.
-			bool running = false, // Is the controller currently running?
-				overriden = false; // Is the controller being overriden by manual control?
+			atomic<bool> running, // Is the controller currently running?
+				overriden; // Is the controller being overriden by manual control?
+			// The output thread sleeps on this while the controller is overriden.
+			mutex stateLock;
+			condition_variable stateChanged;
+			atomic<long long> resumedAt, // When control was last taken back (ns), or 0 if the output thread has seen it.
+				lastResume, worstResume; // How long the output thread took to wake up and resume (ns).
 			string name; // Name of distinct controller.
 			vector< pair<string, int> > pinout; // Map of the configured GPIO pins during session.
+			GPIOBackend * gpio; // What the pins are accessed through.
+			unique_ptr<GPIOBackend> ownedGpio; // The default backend, if none was given.
+			// Shadow of the output pins (by pin ID bit), so writes that change nothing and reads of
+			// a level the controller set itself never reach the hardware.
+			unsigned long long outputs = 0, // Pins configured as outputs.
+				known = 0, // Pins whose level was written since their mode was last set.
+				levels = 0; // The last level written to each known pin.
+			atomic<long long> writesIssued, writesSkipped, readsIssued, readsSkipped;
+			// Input capture. Edges of watched pins are delivered to their sinks by the capture thread.
+			atomic<EdgeSink *> sinks[64];
+			atomic<unsigned long long> watched; // Pins with a sink.
+			atomic<bool> capturing;
+			thread captureThread;
+			long long pollInterval = 20000; // How often inputs are sampled if the backend cannot report edges (ns). See setPollInterval().
 
 			bool init(void); // To solidify the configured GPIO pins.
+			void captureLoop(void);
 			
 		public:
-			Controller(string name);
+			Controller(string name, GPIOBackend * = nullptr);
 			
 			// Pin utilities.
-			int returnPinFromName(string);
-			void configurePin(int, string, int, int);
-			void setPinMode(string, int);
-			void setPinPud(string, int);
-			int readPin(string);
-			void setPin(string, int);
+			int returnPinFromName(const string &);
+			PinHandle getPin(const string &);
+			PinHandle configurePin(int, string, int, int);
+			void setPinMode(const string &, int);
+			void setPinPud(const string &, int);
+			int readPin(const string &);
+			void setPin(const string &, int);
+			void setPinMode(PinHandle, int);
+			void setPinPud(PinHandle, int);
+			int readPin(PinHandle);
+			void setPin(PinHandle, int);
+			void setPins(unsigned long long, unsigned long long);
+			AccessCounters getAccessCounters(void);
+			int getEdgeFd(void);
+			bool readEdge(EdgeEvent &);
+
+			// Input capture.
+			bool watchEdges(PinHandle, EdgeSink &);
+			void feedEdge(const EdgeEvent &);
+			void stopCapture(void);
+			void setPollInterval(long long);
 
 			// Controller state.
 			bool isRunning(void);
 			void setState(bool);
 			bool isOverridden(void);
 			void Override(bool);
+			void waitForControl(void);
+			void getResumeLatency(long long &, long long &);
 
 			string getName(void);
 			void setName(string);
@@ -133,4 +725,132 @@ namespace jacobian {
 			void kill(void); // MUST be called when ending program.
 	};
 
+	/*******************
+	Telemetry
+	/*******************/
+
+	/**
+	 * A log-linear latency histogram in the style of HdrHistogram. Values below 16ns get a bucket
+	 * each; above that every power of two is split into 16 buckets, so any reported value is
+	 * within 6.25% of the truth. Recording is a few relaxed atomic adds, cheap enough for the
+	 * output loop, and the histogram lives happily in shared memory (all zeros is empty).
+	 * 
+	 * @since 1.5.0
+	 */
+	struct LatencyHistogram {
+		static const int SUB_BITS = 4, // Buckets per power of two, as a power of two.
+			SUBS = 1 << SUB_BITS,
+			BUCKETS = (41 - SUB_BITS) * SUBS; // Up to 2^40ns (about 18 minutes).
+		// Values from here on are counted in the top bucket, and as overflows.
+		static const long long RANGE = 1LL << (BUCKETS / SUBS + SUB_BITS - 1);
+		atomic<unsigned long long> count, total, worst, overflows, buckets[BUCKETS];
+
+		void record(long long);
+		void reset(void);
+		long long percentile(double) const;
+		long long mean(void) const;
+		static int bucketOf(long long);
+		static long long lowerBound(int);
+	};
+
+	/**
+	 * Everything the output loop publishes about itself. It is laid out in a shared-memory segment
+	 * so that jacobiantop can read it live; the writer only ever uses relaxed atomics on it.
+	 * 
+	 * @since 1.5.0
+	 */
+	struct TelemetryBlock {
+		static const unsigned long long MAGIC = 0x4a41434f4249414eULL; // "JACOBIAN", set once the block is ready.
+		atomic<unsigned long long> magic;
+		long long pid, // The process that writes the block.
+			started; // CLOCK_MONOTONIC time the block was created (ns).
+		atomic<unsigned long long> iterations, // Trips around the output loop.
+			commands, // Console commands handled.
+			overrides; // Times the transmitter took control.
+		LatencyHistogram tickCost, // Time spent writing an edge, once woken for it (ns).
+			edgeLateness, // How long after its deadline each edge was written (ns).
+			commandLatency; // Time from a console command arriving to it being handled (ns).
+	};
+
+	/**
+	 * Owns the telemetry block of a running JacobianOS, in the POSIX shared-memory segment of the
+	 * given name. If the segment cannot be made, the block lives in private memory instead, so the
+	 * hot path never has to check.
+	 * 
+	 * @since 1.5.0
+	 */
+	class Telemetry {
+		private:
+			string name;
+			TelemetryBlock * block;
+			bool shared; // Is the block in shared memory?
+
+		public:
+			Telemetry(string = "/jacobian");
+			~Telemetry(void);
+			TelemetryBlock & get(void);
+			bool isShared(void);
+			static const TelemetryBlock * attach(string = "/jacobian");
+			static void detach(const TelemetryBlock *);
+	};
+
+	/*******************
+	Multi-channel PWM scheduler
+	/*******************/
+
+	/**
+	 * The scheduler generates several PWM channels of the same frequency from one thread. Once per
+	 * period it merges every channel's edges into a single sorted timeline. Edges that coincide are
+	 * written together as one set/clear mask, so the number of wake-ups per period grows with the
+	 * number of distinct pulse widths rather than the number of channels.
+	 * 
+	 * @since 1.5.0
+	 */
+	class PWMScheduler {
+		private:
+			struct Channel {
+				PWM * pwm;
+				unsigned long long mask; // The bit of the channel's pin ID.
+			};
+			struct Edge {
+				long long offset; // Time since the rising edge of the period (ns).
+				unsigned long long clear; // Pins that fall at this time.
+			};
+			struct Offload {
+				PWM * pwm;
+				unique_ptr<HardwarePWM> hardware; // The kernel PWM channel generating the signal.
+			};
+			int frequency; // (hz)
+			long long period, // (ns)
+				periodStart, // Absolute time of the current period's rising edge.
+				risen, // When the rising edge was actually written; pulse widths are measured from here.
+				coalesce, // Falling edges closer than this are written together (ns).
+				spin; // See waitUntil().
+			unsigned long long risingMask = 0; // Every attached pin rises at the start of a period.
+			vector<Channel> channels;
+			vector<Offload> offloaded; // Channels on pins with a hardware PWM channel.
+			string hardwareRoot = "/sys/class/pwm"; // Where hardware PWM channels are found, or "" for none.
+			vector<Edge> timeline; // This period's falling edges, sorted and merged.
+			size_t next = 0; // Index of the next falling edge in the timeline.
+			// Edge lateness, written by the output thread and read by anyone (ns).
+			atomic<long long> edges, totalLateness, worstLateness;
+			TelemetryBlock * telemetry = nullptr; // Where edge costs are published, if anywhere.
+
+			void plan(void);
+			void record(long long);
+
+		public:
+			PWMScheduler(int, long long = 1000, long long = 50000);
+			bool attach(Controller &, string, PWM &);
+			bool attach(Controller &, PinHandle, PWM &);
+			void setHardwareRoot(string);
+			void setTelemetry(TelemetryBlock *);
+			void service(Controller &);
+			void restart(void);
+			void getLateness(long long &, long long &, long long &);
+			void resetLateness(void);
+	};
+
 }
+
+#endif
@@ -0,0 +1,115 @@
+/**
+ * jacobiandecode is an external software utility included in JacobianOS that dumps a flight
+ * recording (flight.bin by default) as CSV or JSON, oldest event first. The recording may come
+ * from a JacobianOS that is still running or one that crashed; records that were being written
+ * at that moment are skipped.
+ *
+ * @author Ian Wilkey (iwilkey)
+ * @since Jacobian 1.5.0, JacobianOS 1.2.0
+ * @version 1.0.0
+ *
+ * Compilation: g++ jacobiandecode.cpp -o jacobiandecode -std=c++17
+ * Usage: ./jacobiandecode [--json] [path_to_recording]
+ */
+
+#include <iostream>
+#include <fstream>
+#include "../../jacobian.h"
+using namespace std;
+using namespace jacobian;
+
+// Name a FLIGHTEVENT.
+string typeName(unsigned type) {
+	switch(type) {
+		case FLIGHT_COMMAND: return "command";
+		case FLIGHT_SETPOINT: return "setpoint";
+		case FLIGHT_OVERRIDE: return "override";
+		case FLIGHT_STATE: return "state";
+		case FLIGHT_RAMP: return "ramp";
+		case FLIGHT_SEQUENCE: return "sequence";
+	}
+	return "unknown";
+}
+
+// Describe the a and b fields of a record in words.
+string detail(const FlightRecord & record) {
+	switch(record.type) {
+		case FLIGHT_COMMAND: {
+			char text[17] = { 0 };
+			memcpy(text, &record.a, 8);
+			memcpy(text + 8, &record.b, 8);
+			return text;
+		}
+		case FLIGHT_SETPOINT: return to_string(record.b) + "ns -> " + to_string(record.a) + "ns";
+		case FLIGHT_OVERRIDE: return (record.a) ? "set" : "released";
+		case FLIGHT_STATE: return (record.a) ? "started" : "stopped";
+		case FLIGHT_RAMP: return "-> " + to_string(record.a) + "ns over " + to_string(record.b) + "ns";
+		case FLIGHT_SEQUENCE: return "-> " + to_string(record.a) + "ns in " + to_string(record.b) + "ns";
+	}
+	return "";
+}
+
+// Quote a string for CSV or JSON (the two agree on doubling up nothing else we print).
+string quote(string in, bool json) {
+	string out = "\"";
+	for(char c : in) {
+		if(c == '"') out += (json) ? "\\\"" : "\"\"";
+		else if(c == '\\' && json) out += "\\\\";
+		else if((unsigned char)c < 0x20) out += ' ';
+		else out += c;
+	}
+	return out + "\"";
+}
+
+// Main instructions.
+int main(int argc, char ** args) {
+	bool json = false;
+	string path = "flight.bin";
+	for(int i = 1; i < argc; i++) {
+		string arg = args[i];
+		if(arg == "--json") json = true;
+		else path = arg;
+	}
+
+	ifstream in(path, ios::binary);
+	if(!in) {
+		cerr << "Could not open flight recording " << path << "." << endl;
+		return 1;
+	}
+	vector<char> data((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+	if(data.size() < FlightHeader::SIZE) {
+		cerr << path << " is not a flight recording." << endl;
+		return 1;
+	}
+	const FlightHeader * header = (const FlightHeader *)data.data();
+	if(header->magic != FlightHeader::MAGIC || header->recordSize != sizeof(FlightRecord)
+		|| data.size() < FlightHeader::SIZE + header->capacity * sizeof(FlightRecord)) {
+		cerr << path << " is not a flight recording this decoder understands." << endl;
+		return 1;
+	}
+	const FlightRecord * records = (const FlightRecord *)(data.data() + FlightHeader::SIZE);
+
+	// The ring holds the last capacity records claimed.
+	unsigned long long head = header->head.load(),
+		first = (head > header->capacity) ? head - header->capacity : 0;
+	if(json) cout << "[" << endl;
+	else cout << "sequence,time_ns,wall_time_ns,type,channel,a,b,detail" << endl;
+	bool comma = false;
+	for(unsigned long long n = first; n < head; n++) {
+		const FlightRecord & record = records[n % header->capacity];
+		if(record.sequence.load() != n + 1) continue; // Torn or never finished.
+		long long wall = header->realtime + (record.time - header->monotonic);
+		if(json) {
+			cout << ((comma) ? ",\n" : "") << "  {\"sequence\": " << n << ", \"time_ns\": " << record.time
+				<< ", \"wall_time_ns\": " << wall << ", \"type\": \"" << typeName(record.type) << "\", \"channel\": "
+				<< record.channel << ", \"a\": " << record.a << ", \"b\": " << record.b << ", \"detail\": "
+				<< quote(detail(record), true) << "}";
+			comma = true;
+		} else {
+			cout << n << "," << record.time << "," << wall << "," << typeName(record.type) << "," << record.channel
+				<< "," << record.a << "," << record.b << "," << quote(detail(record), false) << endl;
+		}
+	}
+	if(json) cout << endl << "]" << endl;
+	return 0;
+}
@@ -7,326 +7,802 @@
  * which specify sequences of timed commands to translate the car.
  *
  * @since Jacobian 1.4.0
- * @version 1.1.0
+ * @version 1.2.0
  * @author Ian Wilkey (iwilkey)
  * 
- * Compilation: g++ ../jacobian.cpp jacobianos.cpp -o build -lwiringPi -pthread -std=c++11
+ * Compilation: g++ ../jacobian.cpp jors.cpp jacobianos.cpp -o build -lwiringPi -pthread -std=c++17
+ * Without wiringPi: g++ -DJACOBIAN_NO_WIRINGPI ../jacobian.cpp jors.cpp jacobianos.cpp -o build -pthread -std=c++17
  */
 
 #include <iostream>
 #include <fstream>
 #include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <array>
+#include <chrono>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#ifndef JACOBIAN_NO_WIRINGPI
 #include <wiringPi.h>
-#include "../jacobian.h"
+#endif
+#include "jors.h"
 using namespace std;
 using namespace jacobian;
 
-#define VERSION "1.1.0"
+#define VERSION "1.2.0"
+
+// How long before each PWM edge the main loop stops sleeping and spins, in nanoseconds.
+#define EDGE_SPIN 50000
+
+// The drive ESC and the steering servo both take a 60hz signal, so both channels and their scheduler share one frequency.
+typedef FixedPWM<60> CarPWM;
 
 /*******************
 Invokable commands
 /*******************/
 
 /**
- * Translate the car forwards or backwards declairing direction and percentage speed. 
- * Command style: drive (f or b, 0 - 100)[%]...
+ * Stop entire JacobianOS.
+ * Command style: stop (no args)...
+ * 
+ * @params
+ *  Controller c (reference): The actual configured Pi3b Controller object attached to car.
+ */
+void invokeStop(Controller & c) {
+	c.setState(false);
+	return;
+}
+
+/**
+ * Report how late the output loop has been writing PWM edges since the last report, then start
+ * a new measurement. Run a load with and without real-time mode to compare the two. Also report
+ * how quickly the output loop resumed after the override was last released.
+ * Command style: jitter (no args)...
+ * 
+ * @params
+ *  Controller c (reference): The actual configured Pi3b Controller object attached to car.
+ * 	PWMScheduler outputs (reference): The scheduler generating the PWM channels.
+ */
+void invokeJitter(Controller & c, PWMScheduler & outputs) {
+	long long count, mean, worst, lastResume, worstResume;
+	outputs.getLateness(count, mean, worst);
+	outputs.resetLateness();
+	log("Jitter", to_string(count) + " edges, mean lateness " + to_string(mean / 1000.0f) 
+		+ "us, worst lateness " + to_string(worst / 1000.0f) + "us.");
+	c.getResumeLatency(lastResume, worstResume);
+	log("Jitter", "Resuming from override took " + to_string(lastResume / 1000.0f) + "us last time, " 
+		+ to_string(worstResume / 1000.0f) + "us at worst.");
+	return;
+}
+
+/**
+ * Report how many GPIO accesses reached the hardware and how many were skipped because
+ * the controller already knew the pin's level.
+ * Command style: gpio (no args)...
+ * 
+ * @params
+ *  Controller c (reference): The actual configured Pi3b Controller object attached to car.
+ */
+void invokeGpio(Controller & c) {
+	AccessCounters counters = c.getAccessCounters();
+	log("GPIO", "Writes: " + to_string(counters.writesIssued) + " issued, " + to_string(counters.writesSkipped) 
+		+ " skipped. Reads: " + to_string(counters.readsIssued) + " issued, " + to_string(counters.readsSkipped) + " skipped.");
+	return;
+}
+
+// Where the output loop and the command listener publish their telemetry, for jacobiantop to read.
+static TelemetryBlock * stats = nullptr;
+
+// Keeps every command, setpoint change, override and state change of the run, for jacobiandecode.
+static FlightRecorder * recorder = nullptr;
+
+/*******************
+Receiver capture
+/*******************/
+
+// Decoders for the drive and steer channels of the RC receiver, when it is wired to input pins.
+static PulseDecoder receiverDrive, receiverSteer;
+static bool receiverWired = false;
+
+/**
+ * Report the pulse widths the RC receiver is currently sending on the drive and steer channels.
+ * The receiver must be wired (receiverWired).
+ * Command style: transmitter (no args)...
+ */
+void invokeTransmitter(void) {
+	PulseDecoder::Pulse drive, steer;
+	bool heardDrive = receiverDrive.latest(drive),
+		heardSteer = receiverSteer.latest(steer);
+	long long now = monotonicNanos();
+	if(heardDrive)
+		log("Transmitter", "Drive: " + to_string(drive.width / 1000) + "us pulse, " + to_string(drive.frame / 1000) 
+			+ "us frame, " + to_string((now - drive.timestamp) / 1000000) + "ms ago.");
+	else log("Transmitter", "Drive: no pulses yet.");
+	if(heardSteer)
+		log("Transmitter", "Steer: " + to_string(steer.width / 1000) + "us pulse, " + to_string(steer.frame / 1000) 
+			+ "us frame, " + to_string((now - steer.timestamp) / 1000000) + "ms ago.");
+	else log("Transmitter", "Steer: no pulses yet.");
+	return;
+}
+
+/*******************
+Wheel encoder
+/*******************/
+
+// Counts the edges of the wheel encoder, when it is wired to an input pin.
+static EdgeCounter * encoder = nullptr;
+
+// How far back the encoder speed is averaged, in nanoseconds.
+#define ENCODER_WINDOW 250000000
+
+/**
+ * Report the edges counted on the wheel encoder and the current wheel speed. The encoder must be
+ * wired (encoder is set).
+ * Command style: encoder (no args)...
+ */
+void invokeEncoder(void) {
+	log("Encoder", to_string(encoder->getCount()) + " edges, " + to_string(encoder->getRate(ENCODER_WINDOW)) 
+		+ " edges/s, " + to_string(encoder->getRPM(ENCODER_WINDOW)) + " RPM.");
+	return;
+}
+
+/*******************
+Routine runner
+/*******************/
+
+// Every source of commands (the console, the command server) goes through runCommand() under this
+// lock, one command at a time, and shares the state below with the others. A routine takes it for
+// each of its steps, but not for the waits between them.
+static mutex commandLock;
+static bool commandLog = false, // The JacobianOS log option (writing output to console).
+	carReverse = false; // The reverse mode of the car.
+
+// A routine runs on its own thread, so the console and the command server are never held up by it.
+// Setting routineCancel (under commandLock and routineWaitLock) calls it off; its waits sleep on
+// routineWake, so that wakes them at once.
+static thread routineThread;
+static atomic<bool> routineRunning(false),
+	routineCancel(false);
+static mutex routineWaitLock;
+static condition_variable routineWake;
+
+// How long before a step is due a routine stops listening for a cancel and sleeps to the deadline, in nanoseconds.
+#define ROUTINE_WAKE 1000000
+
+/**
+ * Wait until a routine step is due, unless the routine is called off first.
+ * 
+ * @params
+ * 	long long deadline: When the step is due (CLOCK_MONOTONIC ns).
+ * @return true if the step is due, false if the routine was called off.
+ */
+static bool waitForStep(long long deadline) {
+	long long wake = deadline - ROUTINE_WAKE;
+	unique_lock<mutex> lock(routineWaitLock);
+	while(!routineCancel.load(memory_order_relaxed) && monotonicNanos() < wake)
+		routineWake.wait_until(lock, chrono::steady_clock::time_point(chrono::nanoseconds(wake)));
+	if(routineCancel.load(memory_order_relaxed)) return false;
+	lock.unlock();
+	waitUntil(deadline);
+	return true;
+}
+
+// Call off the routine that is running, if any. The caller holds commandLock, so no step of it runs after this.
+static void cancelRoutine(void) {
+	if(!routineRunning.load(memory_order_relaxed)) return;
+	{
+		lock_guard<mutex> lock(routineWaitLock);
+		routineCancel = true;
+	}
+	routineWake.notify_all();
+	return;
+}
+
+/**
+ * Run a compiled JORS routine. Nothing is parsed here: each step is a switch on its opcode and a
+ * setpoint that was worked out by compileJORS().
+ * 
+ * Each step is due at an absolute time from the start of the routine, the sum of the waits before
+ * it, and is started by sleeping until that time. Time spent inside steps (logging, a busy
+ * CPU) therefore comes out of the following wait instead of adding to every later step, so timing errors do not accumulate over a long routine. A step that is
+ * already late starts at once, and the steps after it are back on schedule as soon as a wait
+ * absorbs the overrun.
+ * 
+ * The routine is run from the routine thread. Each step is carried out under commandLock, and the
+ * routine stops before the next step once it has been called off.
+ * 
+ * @params
+ * 	JORSProgram program (reference): The compiled routine.
+ * 	bool dlog (reference): The state of the JacobianOS log option (writing output to console).
+ * 	bool reverse (reference): The state of the reverse mode on the car.
+ * 	PWM drive (reference): The driver PWM channel.
+ * 	PWM steer (reference): The steer PWM channel.
+ * 	vector<long long> started (reference): Filled in with when each step that ran actually started, from the start of the routine (ns).
+ * @return true if the routine ran to its end, false if it was called off.
+ */
+bool runJORS(const JORSProgram & program, bool & dlog, bool & reverse, PWM & drive, PWM & steer, vector<long long> & started) {
+	started.assign(program.steps.size(), 0);
+	long long start = monotonicNanos();
+	for(size_t i = 0; i < program.steps.size(); i++) {
+		const JORSStep & step = program.steps[i];
+		bool due = waitForStep(start + step.at);
+		lock_guard<mutex> lock(commandLock);
+		if(!due || routineCancel.load(memory_order_relaxed)) {
+			started.resize(i);
+			return false;
+		}
+		started[i] = monotonicNanos() - start;
+		recorder->command(step.text);
+		executeJORS(step, dlog, reverse, drive, steer);
+	}
+	// A routine that ends on a wait holds its last setpoints until the wait is over.
+	return waitForStep(start + program.length);
+}
+
+/**
+ * Report when each step of a routine was due and when it actually started, and how far the
+ * routine drifted overall. Waits are left out: they are only the deadlines of the steps after them.
+ * The report is written out in batches, so none of it is dropped however long the routine.
  * 
  * @params
- * 	string args (reference): The non-parsed arguments passed to command.
+ * 	JORSProgram program (reference): The routine that ran.
+ * 	vector<long long> started (reference): When each step started, as filled in by runJORS(). Only the steps that ran are reported.
+ */
+void reportJORS(const JORSProgram & program, const vector<long long> & started) {
+	long long worst = 0, last = 0;
+	int steps = 0;
+	for(size_t i = 0; i < started.size(); i++) {
+		const JORSStep & step = program.steps[i];
+		if(step.op == JORS_WAIT) continue;
+		long long late = started[i] - step.at;
+		last = late;
+		steps++;
+		worst = max(worst, late);
+		log("JORS Timeline", "Line " + to_string(step.line) + " (" + string(step.text) + "): planned " 
+			+ to_string(step.at / 1e9) + "s, actual " + to_string(started[i] / 1e9) + "s, late " + to_string(late / 1000) + "us.");
+		// A long routine reports more lines than the log ring holds, so write them out as they go.
+		if(steps % 256 == 0) flushLog();
+	}
+	log("JORS Timeline", to_string(steps) + " steps over " + to_string(program.length / 1e9) 
+		+ "s. Worst lateness " + to_string(worst / 1000) + "us, last step " + to_string(last / 1000) + "us late.");
+	return;
+}
+
+/**
+ * Run a JORS script of any length while it is still being parsed. The file is memory-mapped and
+ * parsed ahead on its own thread, so the executor never waits on the disk or on parsing unless the
+ * script outruns the parser. Steps run on the same absolute timeline as runJORS(). Any time a
+ * step was due before the parser had delivered it is counted as an underrun.
+ * 
+ * Unlike load, a syntax error is only found when the parser reaches it, and the routine is then
+ * abandoned there. It is run from the routine thread, and may be called off as runJORS() may.
+ * Command style: stream (path_to_routine)...
+ * 
+ * @params
+ * 	string path: The script.
  * 	bool dlog (reference): The state of the JacobianOS log option (writing output to console).
  * 	bool reverse (reference): The state of the reverse mode on the car.
- * 	PWM drive (reference): The actual PWM object connected to the selected GPIO pinout for the drive motor.
+ * 	PWM drive (reference): The driver PWM channel.
+ * 	PWM steer (reference): The steer PWM channel.
  */
-void invokeDrive(string & args, bool & dlog, bool & reverse, PWM & drive) {
-	vector<string> argTokens = tokenize(args, ' ');
-	if(argTokens.size() != 2) {
-		log("Error", "Drive command must be invoked with exactly two arguments! See \"help\" for details.");
+void streamJORS(string path, bool & dlog, bool & reverse, PWM & drive, PWM & steer) {
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	struct stat status;
+	if(fd < 0 || fstat(fd, &status) != 0) {
+		log("Error", "Routine script does not exist at specified path! See \"help\" for details.");
+		if(fd >= 0) close(fd);
 		return;
 	}
-	int dir = -1; // undef dir.
-	if(argTokens[0] == "f") dir = 1;
-	else if(argTokens[0] == "b") dir = 0;
-	if(dir < 0) {
-		log("Error", "Drive command must be invoked with a valid direction! See \"help\" for details.");
+	size_t size = status.st_size;
+	const char * data = (size > 0) ? (const char *)mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : nullptr;
+	close(fd);
+	if(data == MAP_FAILED) {
+		log("Error", "Could not map routine script: " + string(strerror(errno)));
 		return;
 	}
-	if(dir == 1) {
-		if(reverse) reverse = false;
-		// Forward implementation.
-		int percent = stoi(argTokens[1]); // TODO: Make this a float.
-		percent = (percent > 100) ? 100 : percent;
-		percent = (percent < 0) ? 0 : percent;
-		float time = ((2.0f - 1.5f) * ((float)(percent) / 100.0f)) + 1.5f;
-		drive.setDutyCycle(timeToDutyCycle(60, radixShift(time, MILLI)));
-		if(dlog)
-			log("Success", "The car is now moving forward at " + to_string(percent) + "% of its top speed. Pulse width in ms: " + to_string(time));
+	if(data != nullptr) {
+		madvise((void *)data, size, MADV_SEQUENTIAL);
+		madvise((void *)data, size, MADV_WILLNEED);
+	}
+	
+	unique_ptr<JORSStream> stream(new JORSStream());
+	stream->head = stream->tail = 0;
+	stream->done = stream->cancel = false;
+	thread parser(parseStream, data, size, ref(*stream));
+	
+	// Let the parser get a queue's worth ahead before the clock starts.
+	while(stream->head.load(memory_order_acquire) < STREAM_AHEAD && !stream->done.load(memory_order_acquire))
+		this_thread::sleep_for(chrono::microseconds(200));
+	
+	// An error found before anything has run stops the routine from starting at all.
+	if(stream->done.load(memory_order_acquire) && stream->error != nullptr) {
+		parser.join();
+		if(data != nullptr) munmap((void *)data, size);
+		log("JORS Syntax Error", "Line " + to_string(stream->errorLine) + ": " + stream->error);
+		log("Error", "Routine script has an error and was not run! See \"help\" for details.");
 		return;
-	} else {
-		if(!reverse) {	
-
-			// Backwards implementation.
-			// Needs special timed beginning sequence!
-			
-			// Development note: I notice that my waitForSeconds() method is changing the true
-			// pulse width measured by oscilloscope. I need to find an alternative to delay.
-			// Idea: thread sleep_for()? 
-			 
-			if(dlog) log("Break routine", "Beginning break routine...");
-			drive.setDutyCycle(timeToDutyCycle(60, radixShift(1.05f, MILLI)));
-			if(dlog) log("Break routine", "Holding break...");
-			waitForSeconds(1.0f); // These times should be tweaked to find the shortest possible time for pulse.
-			drive.setDutyCycle(timeToDutyCycle(60, radixShift(1.5, MILLI)));
-			if(dlog) log("Break routine", "Pulsing reset...");
-			waitForSeconds(0.25f);
-
-			// drive.setDutyCycle(timeToDutyCycle(60, radixShift(1.05f, MILLI)));
-			// if(dlog) log("Break routine", "Setting to break mode now...");
-			// waitForSeconds(0.25f);
-
-			reverse = true;
-			if(dlog) 
-				log("Break routine", "Break routine finished.");
-		}
-		
-		int percent = stoi(argTokens[1]); // TODO: Make this a float.
-		percent = (percent > 100) ? 100 : percent;
-		percent = (percent < 0) ? 0 : percent;
-		float time = ((1.0f - 1.5f) * ((float)(percent) / 100.0f)) + 1.5f;
-		drive.setDutyCycle(timeToDutyCycle(60, radixShift(time, MILLI)));
-		
-		if(dlog)
-			log("Success", "The car is now moving backwards at " + to_string(percent) + "% of its top speed. Pulse width in ms: " + to_string(time));
-	}	
+	}
+	
+	log("Success", "JacobianOS is now beginning specified routine...");
+	long long start = monotonicNanos(), steps = 0, worst = 0;
+	JORSStep step;
+	while(takeStream(*stream, start, routineCancel, step)) {
+		bool due = waitForStep(start + step.at);
+		lock_guard<mutex> lock(commandLock);
+		if(!due || routineCancel.load(memory_order_relaxed)) break;
+		if(step.op != JORS_WAIT) worst = max(worst, monotonicNanos() - start - step.at);
+		recorder->command(step.text);
+		executeJORS(step, dlog, reverse, drive, steer);
+		steps++;
+	}
+	bool cancelled = routineCancel.load(memory_order_relaxed);
+	if(stream->error == nullptr && !cancelled) cancelled = !waitForStep(start + stream->length);
+	stream->cancel = true;
+	parser.join();
+	if(data != nullptr) munmap((void *)data, size);
+	
+	if(cancelled) log("JORS Stream", "The routine was called off after " + to_string(steps) + " steps.");
+	else if(stream->error != nullptr) {
+		log("JORS Syntax Error", "Line " + to_string(stream->errorLine) + ": " + stream->error);
+		log("Error", "Routine script was abandoned at line " + to_string(stream->errorLine) + ".");
+	} else log("Success", "JacobianOS has finished specified routine...");
+	double seconds = max(stream->parsing, 1LL) / 1e9;
+	log("JORS Stream", to_string(stream->lines) + " lines parsed at " + to_string((long long)(stream->lines / seconds)) 
+		+ " lines/s. " + to_string(steps) + " steps run, worst lateness " + to_string(worst / 1000) + "us.");
+	if(stream->underruns > 0) 
+		log("JORS Stream", "The parser fell behind the schedule " + to_string(stream->underruns) + " time(s), holding up steps for " 
+			+ to_string(stream->starved / 1000) + "us in total.");
+	else log("JORS Stream", "The parser never fell behind the schedule.");
 	return;
 }
 
 /**
- * Rotate the front axis full right to full left specifiying pulse time in milliseconds * 1000.
- * Command style: steer (1200 - 2000)[ms * 1000]...
+ * Stop the car and centre the steering once a routine is over, as the routine thread's last act.
+ * A routine that was called off leaves the car to whatever called it off.
  * 
  * @params
- * 	string line (reference): The non-parsed command passed.
- * 	bool dlog (reference): The state of the JacobianOS log option (writing output to console).
- * 	PWM steer (reference): The actual PWM object connected to the selected GPIO pinout for the servo motor.
+ * 	PWM drive (reference): The driver PWM channel.
+ * 	PWM steer (reference): The steer PWM channel.
  */
-void invokeSteer(string & line, bool & dlog, PWM & steer) {
-	vector<string> argTokens = tokenize(line, ' ');
-	if(argTokens.size() != 2) {
-		log("Error", "Steer command must be invoked with exactly one specified pulse time (ms) * 1000! See \"help\" for details.");
-		return;
+static void finishRoutine(PWM & drive, PWM & steer) {
+	lock_guard<mutex> lock(commandLock);
+	if(!routineCancel.load(memory_order_relaxed)) {
+		invokeBreak(carReverse, commandLog, drive);
+		steer.setPulseWidth(STEER_CENTER_PULSE);
 	}
-	int time = stoi(argTokens[1]);
-	time = (time > 2000) ? 2000 : time;
-	time = (time < 1200) ? 1200 : time;
-	steer.setDutyCycle(timeToDutyCycle(60, radixShift(((float)time / 1000.0f), MILLI)));
-	if(dlog)
-		log("Success", "The steering pulse width is now set to: " + to_string(((float)time / 1000.0f)));
+	routineRunning = false;
 	return;
 }
 
+// The routine compiled by the last load, which the routine thread runs.
+static JORSProgram routineProgram;
 
 /**
- * Stop car in tracks.
- * Command style: break (no args)...
+ * The routine thread for load: run the compiled routine, report its timeline, and stop the car.
  * 
  * @params
- *  bool reverse (reference): The state of the reverse mode on the car.
- * 	bool dlog (reference): The state of the JacobianOS log option (writing output to console).
- * 	PWM drive (reference): The actual PWM object connected to the selected GPIO pinout for the drive motor.
+ * 	PWM drive (reference): The driver PWM channel.
+ * 	PWM steer (reference): The steer PWM channel.
  */
-void invokeBreak(bool & reverse, bool & dlog, PWM & drive) {
-	if(reverse) {
-		drive.setDutyCycle(timeToDutyCycle(60, radixShift(1.6, MILLI)));
-		waitForSeconds(0.10f);
-		drive.setDutyCycle(timeToDutyCycle(60, radixShift(1.00, MILLI)));
-		goto out;
-	}
-	drive.setDutyCycle(timeToDutyCycle(60, radixShift(1.00, MILLI)));
-	waitForSeconds(0.10f);
-	drive.setDutyCycle(timeToDutyCycle(60, radixShift(1.5, MILLI)));
-	out:;
-	if(dlog)
-		log("Success", "The car has stopped moving.");
+static void loadRoutine(PWM & drive, PWM & steer) {
+	static vector<long long> started;
+	log("Success", "JacobianOS is now beginning specified routine...");
+	bool finished = runJORS(routineProgram, commandLog, carReverse, drive, steer, started);
+	reportJORS(routineProgram, started);
+	if(finished) log("Success", "JacobianOS has finished specified routine...");
+	else log("Success", "The routine was called off after " + to_string(started.size()) + " steps.");
+	finishRoutine(drive, steer);
 	return;
 }
 
 /**
- * Stop entire JacobianOS.
- * Command style: stop (no args)...
+ * The routine thread for stream: run the script while it is parsed, and stop the car.
  * 
  * @params
- *  Controller c (reference): The actual configured Pi3b Controller object attached to car.
+ * 	string path: The script.
+ * 	PWM drive (reference): The driver PWM channel.
+ * 	PWM steer (reference): The steer PWM channel.
  */
-void invokeStop(Controller & c) {
-	c.setState(false);
+static void streamRoutine(string path, PWM & drive, PWM & steer) {
+	streamJORS(path, commandLog, carReverse, drive, steer);
+	finishRoutine(drive, steer);
 	return;
 }
 
 /**
- * Parse specific commands...
+ * Make way for a new routine thread. The caller holds commandLock and has checked that no routine
+ * is running, so the last routine thread has finished, or is only returning, and is joined at once.
+ */
+static void beginRoutine(void) {
+	if(routineThread.joinable()) routineThread.join();
+	routineCancel = false;
+	routineRunning = true;
+	return;
+}
+
+/*******************
+Benchmarks
+/*******************/
+
+// How many calls each benchmark times.
+#define BENCH_CALLS 1000
+
+/**
+ * Time the cost of one log() call as seen by the caller. The console echo is muted while it
+ * runs; the messages still reach the log file.
+ */
+static void benchLog(void) {
+	flushLog();
+	setLogConsole(false);
+	long long drops = getLogDrops(), total = 0, worst = 0;
+	for(int i = 0; i < BENCH_CALLS; i++) {
+		long long start = monotonicNanos();
+		log("Bench", i);
+		long long cost = monotonicNanos() - start;
+		total += cost;
+		worst = max(worst, cost);
+	}
+	flushLog();
+	setLogConsole(true);
+	log("Bench", "log(): " + to_string(BENCH_CALLS) + " calls, mean " + to_string(total / BENCH_CALLS) 
+		+ "ns, worst " + to_string(worst) + "ns, " + to_string(getLogDrops() - drops) + " dropped.");
+	return;
+}
+
+/**
+ * Time the cost of one flight recorder record, as paid by whoever changes a setpoint. The records
+ * are real and appear in the recording.
+ */
+static void benchFlight(void) {
+	long long start = monotonicNanos();
+	for(int i = 0; i < BENCH_CALLS; i++) 
+		recordFlight(FLIGHT_STATE, -1, 1, i);
+	long long total = monotonicNanos() - start;
+	log("Bench", "recordFlight(): " + to_string(BENCH_CALLS) + " calls, mean " + to_string(total / BENCH_CALLS) + "ns.");
+	return;
+}
+
+/**
+ * Compare running a JORS script the old way, tokenizing and string-comparing each line as it is
+ * reached, with compiling it up front and dispatching the compiled steps. Nothing is driven: only
+ * the parsing and dispatch are timed, over many passes of the script.
+ * 
+ * @params
+ * 	string path: The script.
+ * @return what was wrong, or an empty string if the script was measured.
+ */
+static string benchJORS(string path) {
+	ifstream in(path);
+	if(!in) return "Routine script does not exist at specified path! See \"help\" for details.";
+	stringstream script;
+	script << in.rdbuf();
+	const int passes = 200;
+	volatile long long sink = 0;
+	
+	// The old path: every line is tokenized, compared and converted when it runs.
+	long long lines = 0, start = monotonicNanos();
+	for(int pass = 0; pass < passes; pass++) {
+		istringstream text(script.str());
+		string line;
+		while(getline(text, line)) {
+			if(line.empty()) continue;
+			lines++;
+			string command, args;
+			for(size_t c = 0; c < line.size(); c++) {
+				if(line[c] == ' ') {
+					command = line.substr(0, c);
+					args = line.substr(c + 1, line.size() - c);
+					break;
+				}
+			}
+			if(command == "drive") sink = sink + stoi(tokenize(args, ' ').back());
+			else if(command == "steer") sink = sink + stoi(tokenize(line, ' ').back());
+			else if(line == "break") sink = sink + 1;
+			else if(command == "log") sink = sink + args.size();
+			else if(command == "wait") sink = sink + (long long)stof(tokenize(line, ' ').back());
+		}
+	}
+	long long legacy = monotonicNanos() - start;
+	
+	// The compiled path: parse and check once, then dispatch on opcodes.
+	JORSProgram program;
+	start = monotonicNanos();
+	for(int pass = 0; pass < passes; pass++) {
+		istringstream text(script.str());
+		if(compileJORS(text, program) > 0) return "Routine script has errors, so it cannot be measured.";
+	}
+	long long compile = monotonicNanos() - start;
+	start = monotonicNanos();
+	for(int pass = 0; pass < passes; pass++) {
+		for(const JORSStep & step : program.steps) {
+			switch(step.op) {
+				case JORS_DRIVE_FORWARD: case JORS_DRIVE_REVERSE: case JORS_STEER: 
+				case JORS_RAMP_DRIVE_FORWARD: case JORS_RAMP_DRIVE_REVERSE: case JORS_RAMP_STEER:
+					sink = sink + step.pulse.count(); 
+					break;
+				case JORS_BREAK: sink = sink + 1; break;
+				case JORS_WAIT: sink = sink + (long long)step.seconds; break;
+				case JORS_LOG: sink = sink + step.line; break;
+			}
+		}
+	}
+	long long dispatch = monotonicNanos() - start;
+	
+	lines = max(lines, 1LL);
+	log("Bench", "JORS, " + to_string(lines / passes) + " lines: line-by-line parse and dispatch " + to_string(legacy / lines) 
+		+ "ns/line at run time. Compiled: parse " + to_string(compile / lines) + "ns/line up front, dispatch " 
+		+ to_string(dispatch / lines) + "ns/step at run time.");
+	return "";
+}
+
+/**
+ * Compare the cost of parsing and dispatching console commands the old way (copies into strings,
+ * tokenize() and a chain of string compares) with splitWords(), the command word hash table and
+ * parseJORSWords(). Nothing is carried out, so the car does not move. Reports the commands per
+ * second of each; that the shared parser does not allocate is checked by jacobiantest.
+ */
+static void benchParse(void) {
+	static const char * const COMMANDS[] = { "drive f 50", "steer 1600", "break", "drive b 30", 
+		"ramp drive f 0 80 2.0", "curve steer 1200 2000 0.5", "override 0", "jitter" };
+	const int rounds = BENCH_CALLS * 10,
+		commands = rounds * (sizeof(COMMANDS) / sizeof(COMMANDS[0]));
+	volatile long long sink = 0;
+	
+	// The old path, as the console loop did it.
+	long long start = monotonicNanos();
+	for(int round = 0; round < rounds; round++) {
+		for(const char * text : COMMANDS) {
+			static string line, command, args;
+			line = text;
+			command = line;
+			for(size_t c = 0; c < line.size(); c++) {
+				if(line[c] == ' ') {
+					command = line.substr(0, c);
+					args = line.substr(c + 1, line.size() - c);
+					break;
+				}
+			}
+			if(command == "stop") sink = sink + 1;
+			else if(command == "load") sink = sink + 2;
+			else if(command == "drive") sink = sink + stoi(tokenize(args, ' ').back());
+			else if(command == "break") sink = sink + 3;
+			else if(command == "steer") sink = sink + stoi(tokenize(line, ' ').back());
+			else if(command == "ramp" || command == "curve") sink = sink + tokenize(line, ' ').size();
+			else if(command == "override") sink = sink + tokenize(line, ' ').size();
+			else if(command == "jitter") sink = sink + 4;
+		}
+	}
+	long long legacy = monotonicNanos() - start;
+	
+	// The shared parser.
+	start = monotonicNanos();
+	for(int round = 0; round < rounds; round++) {
+		for(const char * text : COMMANDS) {
+			string_view line = text, 
+				words[MAX_WORDS];
+			size_t count = splitWords(line, words, MAX_WORDS);
+			switch(lookupWord(words[0])) {
+				case WORD_DRIVE: case WORD_BREAK: case WORD_STEER: case WORD_RAMP: case WORD_CURVE: {
+					JORSStep step;
+					long long at = 0;
+					const char * error;
+					if(parseJORSWords(words, count, line, 0, at, step, error)) sink = sink + step.pulse.count();
+					break;
+				}
+				case WORD_OVERRIDE: sink = sink + (words[1] != "0"); break;
+				default: sink = sink + count; break;
+			}
+		}
+	}
+	long long shared = monotonicNanos() - start;
+	
+	log("Bench", "Commands, old parse and dispatch: " + to_string(legacy / commands) + "ns/command (" 
+		+ to_string((long long)(commands * 1e9 / max(legacy, 1LL))) + " commands/s).");
+	log("Bench", "Commands, shared parser and word table: " + to_string(shared / commands) + "ns/command (" 
+		+ to_string((long long)(commands * 1e9 / max(shared, 1LL))) + " commands/s).");
+	return;
+}
+
+/**
+ * Measure what a part of JacobianOS costs.
+ * Command style: bench (what)...
  * 
  * @params
+ * 	string_view what: The part to measure ("log", "flight", "parse" or "jors path_to_routine").
+ * @return what was wrong, or an empty string if it was measured.
+ */
+string invokeBench(string_view what) {
+	if(what.substr(0, 5) == "jors ") return benchJORS(string(what.substr(5)));
+	if(what == "parse") {
+		benchParse();
+		return "";
+	}
+	if(what == "log") {
+		benchLog();
+		return "";
+	}
+	if(what == "flight") {
+		benchFlight();
+		return "";
+	}
+	return "Bench command must be invoked with something to measure (log, flight, parse or jors)! See \"help\" for details.";
+}
+
+// Is the command server taking commands? Has the console finished?
+static atomic<bool> serving(false),
+	consoleDone(false);
+
+/**
+ * Log what is wrong with a command, and make it the command's reply.
+ * 
+ * @params
+ * 	string reply (reference): Set to "error " and the message.
+ * 	string message: What is wrong.
+ * @return true, for runCommand() to return.
+ */
+static bool refuse(string & reply, const string & message) {
+	log("Error", message);
+	reply = "error " + message;
+	return true;
+}
+
+/**
+ * Carry out one command line, as typed at the console. Anything else that gives commands goes
+ * through here too, so every command has one meaning and one parser. The caller must hold
+ * commandLock. Mistakes are logged, as they always have been, and also given back in the reply.
+ * 
+ * @params
+ * 	string_view line: The command line.
  * 	Controller c (reference): The controller to command to.
  *	PWM drive (reference): The driver PWM channel.
  * 	PWM steer (reference): The steer PWM channel.
+ * 	PWMScheduler outputs (reference): The scheduler generating both channels.
+ * 	bool dlog (reference): The state of the JacobianOS log option (writing output to console).
+ * 	bool reverse (reference): The state of the reverse mode on the car.
+ * 	long long received: When the line arrived (CLOCK_MONOTONIC ns), for the flight recorder.
+ * 	string reply (reference): Set to "ok" once the command has been carried out (a routine, once
+ * 		it has started), or to "error " and what was wrong.
+ * @return false if the command was stop, true otherwise.
  */
-static void command(Controller & c, PWM & drive, PWM & steer) {
-	bool dlog = false,
-		reverse = false;
-	while(true) {
-		
-		cout << "[Command ready]: ";
-		static string line, command, args;
-		getline(cin, line);
-		command = line;
-		
-		// Tokenize command...
-		for(int c = 0; c < line.size(); c++) {
-			if(line[c] == ' ') {
-				command = line.substr(0, c);
-				args = line.substr(c + 1, line.size() - c);
-				break;
-			}
-		}
+static bool runCommand(string_view line, Controller & c, PWM & drive, PWM & steer, PWMScheduler & outputs, bool & dlog, 
+	bool & reverse, long long received, string & reply) {
+	recorder->command(line, received);
+	reply = "ok";
+	
+	// Tokenize command... The words point into the line, so nothing here allocates.
+	string_view words[MAX_WORDS];
+	size_t count = splitWords(line, words, MAX_WORDS);
 	
+	switch(lookupWord(words[0])) {
+		
 		// Terminate entire program.
 		// Command style: stop (no args)...
-		if(command == "stop") {
+		case WORD_STOP:
+			cancelRoutine();
 			invokeStop(c);
-			break;
-		}
+			return false;
 		
-		// Load a routine script written in JacobianOS Rountine Script (.jors).
+		// Load a routine script written in JacobianOS Rountine Script (.jors). It is compiled here and
+		// run on the routine thread, so this returns as soon as the routine has started.
 		// Command style: load (path_to_jrs)...
-		if(command == "load") {
-			
-			vector<string> argTokens = tokenize(line, ' ');
-			if(argTokens.size() != 2) {
-				log("Error", "Load command must be invoked with a path to routine script! See \"help\" for details.");
-				continue;
-			}
-			
-			vector<string> subArgs = tokenize(argTokens[1], '.');
-			if(subArgs.size() != 2) {
-				log("Error", "Routine script is in an invalid format! See \"help\" for details.");
-				continue;
-			}
-			if(subArgs[1] != "jors") {
-				log("Error", "Routine script must be a JacobianOS Routine Script (.jors)! See \"help\" for details.");
-				continue;
-			}
+		case WORD_LOAD: {
+			if(routineRunning.load(memory_order_relaxed)) 
+				return refuse(reply, "A routine is already running! Call it off with \"break\" first.");
+			if(count != 2) 
+				return refuse(reply, "Load command must be invoked with a path to routine script! See \"help\" for details.");
+			string_view path = words[1];
+			if(path.size() <= 5 || path.substr(path.size() - 5) != ".jors") 
+				return refuse(reply, "Routine script must be a JacobianOS Routine Script (.jors)! See \"help\" for details.");
 			
 			ifstream in;
-			in.open(subArgs[0] + ".jors");
-			
-			if(!in) {
-				log("Error", "Routine script does not exist at specified path! See \"help\" for details.");
-				continue;
-			}
+			in.open(string(path));
 			
-			string line;
-			int comC = 0;
-			log("Success", "JacobianOS is now beginning specified routine...");
-			while(getline(in, line)) {
-				comC++;
-				if(line.empty()) continue;
-				// Reading JORS...
-				
-				// Tokenize line...
-				string command, args;
-				for(int c = 0; c < line.size(); c++) {
-					if(line[c] == ' ') {
-						command = line.substr(0, c);
-						args = line.substr(c + 1, line.size() - c);
-						break;
-					}
-				}
-				
-				if(command == "drive") {
-					invokeDrive(args, dlog, reverse, drive);
-					continue;
-				}
-				
-				if(command == "steer") {
-					invokeSteer(line, dlog, steer);
-					continue;
-				}
-				
-				if(line == "break") {
-					invokeBreak(reverse, dlog, drive);
-					continue;
-				}
-				
-				if(command == "log") {
-					log("JORS Log", args);
-					continue;
-				}
-				
-				if(command == "wait") {
-					vector<string> argTokens = tokenize(line, ' ');
-					if(argTokens.size() != 2) {
-						log("JORS Syntax Error", "Wait time must be specified as: wait (float)[time in seconds].");
-						continue;
-					}
-					waitForSeconds(stof(argTokens[1]));
-					continue;
-				}
-				
-				log("JORS Syntax Error", "Unknown command at line " + to_string(comC));
-			}
+			if(!in) 
+				return refuse(reply, "Routine script does not exist at specified path! See \"help\" for details.");
 			
+			// Compile the whole routine before the car moves.
+			int errors = compileJORS(in, routineProgram);
 			in.close();
-			log("Success", "JacobianOS has finished specified routine...");
-			invokeBreak(reverse, dlog, drive);
-			steer.setDutyCycle(9.6f);
-			continue;
+			if(errors > 0) 
+				return refuse(reply, "Routine script has " + to_string(errors) + " error(s) and was not run! See \"help\" for details.");
+			beginRoutine();
+			routineThread = thread(loadRoutine, ref(drive), ref(steer));
+			return true;
 		}
 		
-		if(command == "drive") {
-			invokeDrive(args, dlog, reverse, drive);
-			continue;
-		}
+		// Run a routine script of any length while it is still being parsed, on the routine thread.
+		// Command style: stream (path_to_jors)...
+		case WORD_STREAM:
+			if(routineRunning.load(memory_order_relaxed)) 
+				return refuse(reply, "A routine is already running! Call it off with \"break\" first.");
+			if(count != 2) 
+				return refuse(reply, "Stream command must be invoked with a path to routine script! See \"help\" for details.");
+			if(access(string(words[1]).c_str(), R_OK) != 0) 
+				return refuse(reply, "Routine script does not exist at specified path! See \"help\" for details.");
+			beginRoutine();
+			routineThread = thread(streamRoutine, string(words[1]), ref(drive), ref(steer));
+			return true;
 		
-		// Stop car in tracks.
+		// Translate the car, stop it, steer it, or ramp either smoothly. These are parsed and carried
+		// out exactly as the same lines in a routine script are. Any of them calls off a routine that
+		// is running, so the car follows the last order given.
+		// Command style: drive (f or b, 0 - 100)[%]...
 		// Command style: break (no args)...
-		if(command == "break") {
-			invokeBreak(reverse, dlog, drive);
-			continue;
-		}
-		
-		// Rotate the front axis full right to full left specifiying pulse time in milliseconds * 1000.
 		// Command style: steer (1200 - 2000)[ms * 1000]...
-		if(command == "steer") {
-			invokeSteer(line, dlog, steer);
-			continue;
+		// Command style: ramp/curve drive (f or b) (0 - 100)[%] (0 - 100)[%] (seconds)...
+		// Command style: ramp/curve steer (1200 - 2000)[ms * 1000] (1200 - 2000)[ms * 1000] (seconds)...
+		case WORD_DRIVE: case WORD_BREAK: case WORD_STEER: case WORD_RAMP: case WORD_CURVE: {
+			JORSStep step;
+			long long at = 0;
+			const char * error;
+			if(!parseJORSWords(words, count, line, 0, at, step, error)) 
+				return refuse(reply, string(error) + " See \"help\" for details.");
+			cancelRoutine();
+			executeJORS(step, dlog, reverse, drive, steer);
+			return true;
 		}
 		
+		case WORD_WAIT:
+			return refuse(reply, "Wait is only understood in a routine script! See \"help\" for details.");
+		
 		// Set the manual override true or false with software.
 		// Command style: override (0 or 1)...
-		if(command == "override") {
-			vector<string> argTokens = tokenize(line, ' ');
-			if(argTokens.size() != 2) {
-				log("Error", "Override command must be invoked with exactly one specified state! See \"help\" for details.");
-				continue;
-			}
-			if(args == "0") {
-				c.Override(false);
-				continue;
-			}
-			c.Override(true);
-			continue;
+		case WORD_OVERRIDE:
+			if(count != 2) 
+				return refuse(reply, "Override command must be invoked with exactly one specified state! See \"help\" for details.");
+			c.Override(words[1] != "0");
+			return true;
+		
+		// Report the PWM edge lateness since the last report.
+		// Command style: jitter (no args)...
+		case WORD_JITTER:
+			invokeJitter(c, outputs);
+			return true;
+		
+		// Report the hardware accesses issued and skipped.
+		// Command style: gpio (no args)...
+		case WORD_GPIO:
+			invokeGpio(c);
+			return true;
+		
+		// Report what the RC receiver is sending.
+		// Command style: transmitter (no args)...
+		case WORD_TRANSMITTER:
+			if(!receiverWired) 
+				return refuse(reply, "The receiver is not wired! Start JacobianOS with --receiver <drivePin> <steerPin>.");
+			invokeTransmitter();
+			return true;
+		
+		// Report the wheel encoder count and speed.
+		// Command style: encoder (no args)...
+		case WORD_ENCODER:
+			if(encoder == nullptr) 
+				return refuse(reply, "The encoder is not wired! Start JacobianOS with --encoder <pin> [edges_per_revolution].");
+			invokeEncoder();
+			return true;
+		
+		// Measure what a part of JacobianOS costs.
+		// Command style: bench (what)...
+		case WORD_BENCH: {
+			string error = invokeBench((count > 1) ? line.substr(words[1].data() - line.data()) : string_view());
+			return (error.empty()) ? true : refuse(reply, error);
 		}
 		
-		if(command == "log") {
+		case WORD_LOG:
 			dlog = !dlog;
 			if(dlog) 
 				log("Success", "JacobianOS is now set to log commands.");
 			else log("Success", "JacobianOS will now discontinue to log commands.");
-			continue;
-		}
+			return true;
 		
 		// General help command. Use when the format of commands is forgotten.
-		if(command == "help") {
+		case WORD_HELP:
 			cout << endl;
 			cout << "JacobianOS version " << VERSION << endl;
 			cout << "List of valid commands..." << endl;
@@ -334,54 +810,597 @@ static void command(Controller & c, PWM & drive, PWM & steer) {
 			cout << "	help (no args): General help command. Use when the format of commands is forgotten." << endl;
 			cout << "	log (no args): This will toggle the debug command logging." << endl;
 			cout << "	load (path_to_routine): Load a *.jors file to automate commands. JORS documentation outlined on github." << endl;
+			cout << "	stream (path_to_routine): Run a very large *.jors file while it is still being parsed." << endl;
 			cout << "	stop (no args): Terminate entire application." << endl;
 			cout << "	drive ('f' or 'b', 0 - 100): Translate the car forwards or backwards specifying direction and percentage max speed." << endl;
+			cout << "	ramp ('drive', 'f' or 'b', 0 - 100, 0 - 100, seconds): Ramp the speed linearly from one percentage of max speed to another over a time." << endl;
+			cout << "	ramp ('steer', 1200 - 2000, 1200 - 2000, seconds): Ramp the steering linearly from one pulse time to another over a time." << endl;
+			cout << "	curve (same as ramp): Ramp along an S-curve that eases in and out instead of a straight line." << endl;
 			cout << "	break (no args): Stop the car from translating instantaneously." << endl;
 			cout << "	steer (1200 - 2000): Rotate the front axis full right to full left specifiying pulse time in milliseconds * 1000." << endl;
 			cout << "	override (0 or 1): Set the manual override true or false with software." << endl;
+			cout << "	jitter (no args): Report how late PWM edges have been written since the last report." << endl;
+			cout << "	gpio (no args): Report how many GPIO reads and writes reached the hardware or were skipped." << endl;
+			cout << "	transmitter (no args): Report the pulse widths decoded from the RC receiver (needs --receiver)." << endl;
+			cout << "	encoder (no args): Report the edges counted on the wheel encoder and the wheel RPM (needs --encoder)." << endl;
+			cout << "	bench (log, flight, parse or jors path_to_routine): Measure the cost of a part of JacobianOS, e.g. the mean and worst nanoseconds of one log call." << endl;
 			cout << endl;
-			continue;
+			return true;
+		
+		default:
+			return refuse(reply, "JacobianOS does not understand this command! Please type \"help\" for a list of commands.");
+	}
+	return true;
+}
+
+/**
+ * Parse specific commands...
+ * 
+ * @params
+ * 	Controller c (reference): The controller to command to.
+ *	PWM drive (reference): The driver PWM channel.
+ * 	PWM steer (reference): The steer PWM channel.
+ * 	PWMScheduler outputs (reference): The scheduler generating both channels.
+ */
+static void command(Controller & c, PWM & drive, PWM & steer, PWMScheduler & outputs) {
+	long long received = 0; // When the command being handled arrived.
+	string reply; // Not shown: the console sees mistakes in the log.
+	while(true) {
+		
+		if(received > 0) {
+			stats->commandLatency.record(monotonicNanos() - received);
+			stats->commands.fetch_add(1, memory_order_relaxed);
+		}
+		
+		cout << "[Command ready]: ";
+		// The line keeps its capacity from one command to the next, so reading it does not
+		// allocate once the first few commands have been read.
+		static string line;
+		if(!getline(cin, line)) {
+			// The console has closed. With no command server either, nothing could stop the car any more.
+			if(!serving) line = "stop";
+			else {
+				log("Success", "The console has closed. Commands are still taken on the command socket.");
+				break;
+			}
 		}
+		received = monotonicNanos();
+		lock_guard<mutex> lock(commandLock);
+		if(!runCommand(line, c, drive, steer, outputs, commandLog, carReverse, received, reply)) break;
+	}
+	consoleDone = true;
+	return;
+}
+
+/*******************
+Command server
+/*******************/
+
+// The most clients the command server serves at once.
+#define SOCKET_CLIENTS 16
+
+// The longest command line a client may send (bytes).
+#define SOCKET_LINE 1024
+
+// The most replies a client may leave unread before it is dropped (bytes).
+#define SOCKET_BACKLOG 65536
 
-		log("Error", "JacobianOS does not understand this command! Please type \"help\" for a list of commands.");
+// One client of the command server: what it has sent that is not yet a whole line, and the
+// replies it has not yet taken.
+struct SocketClient {
+	string in, out;
+	bool skipping = false; // Is the line coming in too long, and being thrown away?
+	bool writing = false; // Is the server waiting for the client to take its replies?
+};
+
+/**
+ * Open the command server socket, a Unix domain stream socket, replacing any left behind by a
+ * JacobianOS that did not exit cleanly.
+ * 
+ * @params
+ * 	string path: Where to bind the socket.
+ * @return the listening socket, or -1 if it could not be opened.
+ */
+static int openCommandSocket(string path) {
+	sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+	if(path.size() >= sizeof(address.sun_path)) {
+		log("Error", "The command socket path is too long: " + path);
+		return -1;
+	}
+	memcpy(address.sun_path, path.c_str(), path.size() + 1);
+	int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	unlink(path.c_str());
+	if(listener < 0 || bind(listener, (sockaddr *)&address, sizeof(address)) != 0 || listen(listener, SOCKET_CLIENTS) != 0) {
+		log("Error", "Could not open the command socket " + path + ": " + strerror(errno));
+		if(listener >= 0) close(listener);
+		return -1;
 	}
+	log("Success", "Taking commands on the command socket " + path + ".");
+	return listener;
+}
+
+/**
+ * Serve commands to every client of the command socket, on this one thread. An epoll loop waits
+ * on the listening socket and every client at once, so a slow or silent client never holds up
+ * the others and no thread is added per client. A command is one line ending in a newline; every
+ * command is carried out by runCommand(), as at the console, and answered with one line: "ok"
+ * once it has been carried out, or "error " and what was wrong (which is logged too). Replies wait in a buffer for a
+ * client that is not reading, and a client that lets more than SOCKET_BACKLOG bytes pile up,
+ * or any client past SOCKET_CLIENTS, is dropped. A routine runs on the routine thread, so commands
+ * are still served while it runs, and stop, break or any other drive or steer command calls it off
+ * before the routine's next step.
+ * 
+ * Returns, closing the socket, once JacobianOS stops.
+ * 
+ * @params
+ * 	int listener: The listening socket, from openCommandSocket().
+ * 	string path: Where it is bound, to remove it afterwards.
+ * 	Controller c (reference): The controller to command to.
+ *	PWM drive (reference): The driver PWM channel.
+ * 	PWM steer (reference): The steer PWM channel.
+ * 	PWMScheduler outputs (reference): The scheduler generating both channels.
+ */
+static void serveCommands(int listener, string path, Controller & c, PWM & drive, PWM & steer, PWMScheduler & outputs) {
+	int poller = epoll_create1(EPOLL_CLOEXEC);
+	epoll_event event = {};
+	event.events = EPOLLIN;
+	event.data.fd = listener;
+	epoll_ctl(poller, EPOLL_CTL_ADD, listener, &event);
+	unordered_map<int, SocketClient> clients;
+	epoll_event ready[SOCKET_CLIENTS + 1];
+	char buffer[4096];
+	string reply;
+	while(c.isRunning()) {
+		// Wake up now and then to notice that JacobianOS has stopped.
+		int count = epoll_wait(poller, ready, SOCKET_CLIENTS + 1, 100);
+		for(int i = 0; i < count; i++) {
+			int fd = ready[i].data.fd;
+			
+			// A new client.
+			if(fd == listener) {
+				int accepted = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+				if(accepted < 0) continue;
+				if(clients.size() >= SOCKET_CLIENTS) {
+					log("Error", "The command socket already has " + to_string(SOCKET_CLIENTS) + " clients; one more was turned away.");
+					close(accepted);
+					continue;
+				}
+				event.events = EPOLLIN;
+				event.data.fd = accepted;
+				epoll_ctl(poller, EPOLL_CTL_ADD, accepted, &event);
+				clients[accepted];
+				continue;
+			}
+			
+			// Commands from a client. Each whole line is carried out as soon as it is complete.
+			SocketClient & client = clients[fd];
+			bool open = !(ready[i].events & EPOLLERR);
+			if(open && (ready[i].events & (EPOLLIN | EPOLLHUP))) {
+				ssize_t got = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+				if(got == 0 || (got < 0 && errno != EAGAIN && errno != EINTR)) open = false;
+				for(ssize_t at = 0; at < got; at++) {
+					if(buffer[at] != '\n') {
+						if(client.skipping) continue;
+						client.in += buffer[at];
+						if(client.in.size() > SOCKET_LINE) {
+							client.out += "error line too long\n";
+							client.in.clear();
+							client.skipping = true;
+						}
+						continue;
+					}
+					if(client.skipping) {
+						client.skipping = false;
+						continue;
+					}
+					if(!client.in.empty() && client.in.back() == '\r') client.in.pop_back();
+					long long received = monotonicNanos();
+					{
+						lock_guard<mutex> lock(commandLock);
+						runCommand(client.in, c, drive, steer, outputs, commandLog, carReverse, received, reply);
+					}
+					if(received > 0) {
+						stats->commandLatency.record(monotonicNanos() - received);
+						stats->commands.fetch_add(1, memory_order_relaxed);
+					}
+					client.in.clear();
+					client.out += reply;
+					client.out += '\n';
+				}
+			}
+			
+			// Replies, as many as the client will take without blocking.
+			while(open && !client.out.empty()) {
+				ssize_t sent = send(fd, client.out.data(), client.out.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+				if(sent < 0) {
+					open = (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+					break;
+				}
+				client.out.erase(0, sent);
+			}
+			if(client.out.size() > SOCKET_BACKLOG) {
+				log("Error", "A command socket client stopped taking its replies and was dropped.");
+				open = false;
+			}
+			if(!open) {
+				epoll_ctl(poller, EPOLL_CTL_DEL, fd, nullptr);
+				close(fd);
+				clients.erase(fd);
+				continue;
+			}
+			// Only ask to hear when the client can take more while replies are waiting.
+			if(client.writing != !client.out.empty()) {
+				client.writing = !client.out.empty();
+				event.events = EPOLLIN | ((client.writing) ? (unsigned)EPOLLOUT : 0);
+				event.data.fd = fd;
+				epoll_ctl(poller, EPOLL_CTL_MOD, fd, &event);
+			}
+		}
+	}
+	for(auto & client : clients) close(client.first);
+	close(poller);
+	close(listener);
+	unlink(path.c_str());
+	return;
+}
+
+/*******************
+End-to-end benchmark
+/*******************/
+
+// The command rates the end-to-end benchmark tries by default, in commands per second.
+#define E2E_RATES "1,10,100,1000,10000"
+
+// How many steer pulse widths the benchmark cycles through. They are spread across the whole
+// steering range, so each period's pulse width tells which of the last few commands it came from,
+// whatever jitter the edges have.
+#define E2E_WIDTHS 4
+
+/**
+ * Find a percentile of a set of samples.
+ * 
+ * @params
+ * 	vector<long long> samples (reference): The samples, sorted.
+ * 	double fraction: The percentile as a fraction [0 - 1].
+ * @return the sample at that percentile, or 0 if there are none.
+ */
+static long long percentileOf(const vector<long long> & samples, double fraction) {
+	if(samples.empty()) return 0;
+	size_t at = (size_t)ceil(fraction * samples.size());
+	return samples[(at > 0) ? at - 1 : 0];
+}
+
+/**
+ * Connect to the command server as a client would.
+ * 
+ * @params
+ * 	string path: Where the command socket is bound.
+ * @return the connected socket, or -1.
+ */
+static int connectCommandSocket(string path) {
+	sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+	if(path.size() >= sizeof(address.sun_path)) return -1;
+	memcpy(address.sun_path, path.c_str(), path.size() + 1);
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(fd >= 0 && connect(fd, (sockaddr *)&address, sizeof(address)) != 0) {
+		close(fd);
+		fd = -1;
+	}
+	return fd;
+}
+
+/**
+ * Measure how long a command takes to reach the output, from the moment it arrives to the rising
+ * edge of the first PWM period that carries it. JacobianOS runs as usual, but on SimulatedGPIO, so
+ * no Pi is needed. At each rate, steer commands are fed through runCommand(), the same path as
+ * the console, each one asking for a different pulse width; and then again as a client of the
+ * command server, if it is running. Afterwards the writes to the steer pin are read back, and each
+ * period's pulse width is matched to the last command before it that asked for it. Commands
+ * replaced by another before any period began are counted, not timed.
+ * 
+ * Then commands are fed as fast as they are taken to find the most each path sustains.
+ * JacobianOS stops when the benchmark is done.
+ * 
+ * @params
+ * 	SimulatedGPIO gpio (reference): The backend the controller writes to.
+ * 	PinHandle pin: The steer output pin.
+ * 	string rates: The rates to try, in commands per second, separated by commas.
+ * 	double seconds: How long to try each rate for.
+ * 	string socketPath: Where the command server is taking commands, or empty if it is not.
+ * 	Controller c (reference): The controller.
+ *	PWM drive (reference): The driver PWM channel.
+ * 	PWM steer (reference): The steer PWM channel.
+ * 	PWMScheduler outputs (reference): The scheduler generating both channels.
+ */
+static void benchEndToEnd(SimulatedGPIO & gpio, PinHandle pin, string rates, double seconds, string socketPath, Controller & c, 
+	PWM & drive, PWM & steer, PWMScheduler & outputs) {
+	const unsigned long long mask = 1ULL << pin.id;
+	const int step = (STEER_MAX - STEER_MIN) / E2E_WIDTHS;
+	long long received = 0;
+	char text[32], replies[4096];
+	string reply;
+	vector<SimulatedGPIO::Write> writes;
+	vector<long long> issued, latencies;
+	unsigned long long next = gpio.getWrites(0, writes);
+	int client = -1; // The connection to the command server, for the socket path.
+	
+	// Give the command the console would, or send it to the command server and take any replies waiting.
+	auto give = [&](long long k) {
+		int length = snprintf(text, sizeof(text), "steer %d\n", STEER_MIN + (int)(k % E2E_WIDTHS) * step);
+		received = monotonicNanos();
+		if(client >= 0) {
+			send(client, text, length, MSG_NOSIGNAL);
+			while(recv(client, replies, sizeof(replies), MSG_DONTWAIT) > 0);
+			return;
+		}
+		lock_guard<mutex> lock(commandLock);
+		runCommand(string_view(text, length - 1), c, drive, steer, outputs, commandLog, carReverse, received, reply);
+	};
+	
+	// Let the output loop settle before anything is timed.
+	waitForSeconds(0.5);
+	for(int path = 0; path < 2; path++) {
+		if(path == 1) {
+			if(socketPath.empty()) break;
+			client = connectCommandSocket(socketPath);
+			if(client < 0) {
+				log("Error", "Could not connect to the command socket " + socketPath + ", so its path was not measured.");
+				break;
+			}
+		}
+		const string name = (path == 0) ? "console path" : "command socket";
+		log("Bench", "End-to-end command latency, " + name + ", steer pin " + to_string(pin.id) + ", " 
+			+ to_string(drive.getPeriod() / 1000) + "us periods:");
+		for(const string & field : tokenize(rates, ',')) {
+			double rate = atof(field.c_str());
+			if(rate <= 0) continue;
+			long long count = max(1LL, llround(rate * seconds)),
+				interval = llround(PWM::NANOS_PER_SECOND / rate);
+			issued.assign(count, 0);
+			writes.clear();
+			next = gpio.getWrites(next, writes);
+			writes.clear();
+			
+			// Feed the commands on schedule. One that is due while the last is still running goes at once.
+			// Slow rates would keep the same phase to the PWM periods, so those commands are spread
+			// across a period at random, as real ones are.
+			long long start = monotonicNanos() + interval,
+				spread = (interval > steer.getPeriod()) ? steer.getPeriod() : 0;
+			minstd_rand random(1);
+			for(long long k = 0; k < count; k++) {
+				waitUntil(start + k * interval + ((spread > 0) ? (long long)(random() % spread) : 0), EDGE_SPIN);
+				give(k);
+				issued[k] = received;
+			}
+			double achieved = (count > 1) ? (count - 1) * 1e9 / max(issued.back() - issued.front(), 1LL) : rate;
+			
+			// Give the last command two periods to come out, then match every period to its command.
+			waitUntil(monotonicNanos() + 2 * steer.getPeriod());
+			next = gpio.getWrites(next, writes);
+			latencies.clear();
+			long long rise = -1, matched = -1;
+			for(const SimulatedGPIO::Write & write : writes) {
+				if(write.set & mask) rise = write.timestamp;
+				else if((write.clear & mask) && rise >= 0) {
+					int width = (int)llround((write.timestamp - rise) / 1000.0);
+					// The last command before the rise, or one just before it that came after the period was latched.
+					long long k = (long long)(upper_bound(issued.begin(), issued.end(), rise) - issued.begin()) - 1;
+					for(long long back = k; back >= 0 && back > matched && back > k - E2E_WIDTHS; back--) {
+						if(abs(STEER_MIN + (int)(back % E2E_WIDTHS) * step - width) * 2 < step) {
+							latencies.push_back(rise - issued[back]);
+							matched = back;
+							break;
+						}
+					}
+					rise = -1;
+				}
+			}
+			sort(latencies.begin(), latencies.end());
+			log("Bench", to_string(rate) + " commands/s asked, " + to_string(achieved) + " achieved: " 
+				+ to_string(count) + " commands, " + to_string(latencies.size()) + " reached the output, " 
+				+ to_string(count - (long long)latencies.size()) + " replaced first. Latency p50 " 
+				+ to_string(percentileOf(latencies, 0.5) / 1000) + "us, p99 " + to_string(percentileOf(latencies, 0.99) / 1000) 
+				+ "us, p99.9 " + to_string(percentileOf(latencies, 0.999) / 1000) + "us, max " 
+				+ to_string((latencies.empty()) ? 0 : latencies.back() / 1000) + "us.");
+		}
+		
+		// The most the path sustains: commands back to back for a second. Through the socket, up to
+		// 64 are sent ahead, and a command counts once its reply is back.
+		long long count = 0, 
+			sent = 0,
+			start = monotonicNanos(),
+			elapsed = 0;
+		for(; elapsed < PWM::NANOS_PER_SECOND; elapsed = monotonicNanos() - start) {
+			if(client < 0) {
+				give(count++);
+				continue;
+			}
+			if(sent - count < 64) {
+				int length = snprintf(text, sizeof(text), "steer %d\n", STEER_MIN + (int)(sent % E2E_WIDTHS) * step);
+				send(client, text, length, MSG_NOSIGNAL);
+				sent++;
+			}
+			ssize_t got = recv(client, replies, sizeof(replies), (sent - count < 64) ? MSG_DONTWAIT : 0);
+			for(ssize_t at = 0; at < got; at++) count += (replies[at] == '\n');
+		}
+		log("Bench", "Most sustained through the " + name + ": " + to_string((long long)(count * 1e9 / elapsed)) 
+			+ " commands/s (" + to_string(elapsed / max(count, 1LL)) + "ns/command).");
+	}
+	if(client >= 0) close(client);
+	
+	lock_guard<mutex> lock(commandLock);
+	runCommand("stop", c, drive, steer, outputs, commandLog, carReverse, received, reply);
 	return;
 }
 
 // Main instructions.
+// Usage: ./build [--rt [cpu] [priority]] [--gpiomem [path] | --gpiochip [path] [--line-offsets]] [--receiver drivePin steerPin] [--encoder pin [edgesPerRevolution]] [--poll us] [--recorder path] [--socket [path]] [--bench [rates] [seconds]]
 int main(int argc, char ** args) {
 	
+	// Real-time mode is opt-in. By default the output thread takes the last CPU, where an isolated core usually is.
+	bool realtime = false;
+	int rtCpu = (int)thread::hardware_concurrency() - 1,
+		rtPriority = 80;
+	// The GPIO registers may be mapped directly instead of going through wiringPi.
+	static unique_ptr<GPIOBackend> gpio;
+	// Or the GPIO character device, where pin IDs may be taken as line offsets as they are (for simulated chips).
+	string chipPath;
+	bool lineOffsets = false;
+	// The RC receiver's drive and steer channels may be wired to input pins.
+	int receiverDrivePin = -1,
+		receiverSteerPin = -1;
+	// So may a wheel encoder.
+	int encoderPin = -1;
+	double encoderEdges = 1;
+	// Without edge events from the kernel, watched pins are sampled this often (us).
+	long long pollMicros = 0;
+	// The flight recording is always on; only its file may be chosen.
+	string recording = "flight.bin";
+	// Commands may also be taken on a Unix domain socket.
+	string socketPath;
+	// The end-to-end benchmark runs on simulated GPIO instead of taking commands.
+	bool benchmark = false;
+	string benchRates = E2E_RATES;
+	double benchSeconds = 5;
+	for(int i = 1; i < argc; i++) {
+		string arg = args[i];
+		if(arg == "--rt") {
+			realtime = true;
+			if(i + 1 < argc && isdigit(args[i + 1][0])) rtCpu = atoi(args[++i]);
+			if(i + 1 < argc && isdigit(args[i + 1][0])) rtPriority = atoi(args[++i]);
+		} else if(arg == "--gpiomem") {
+			if(i + 1 < argc && args[i + 1][0] != '-') gpio.reset(new MappedGPIO(args[++i]));
+			else gpio.reset(new MappedGPIO());
+		} else if(arg == "--gpiochip") {
+			chipPath = (i + 1 < argc && args[i + 1][0] != '-') ? args[++i] : "/dev/gpiochip0";
+		} else if(arg == "--line-offsets") {
+			lineOffsets = true;
+		} else if(arg == "--receiver" && i + 2 < argc) {
+			receiverDrivePin = atoi(args[++i]);
+			receiverSteerPin = atoi(args[++i]);
+		} else if(arg == "--encoder" && i + 1 < argc) {
+			encoderPin = atoi(args[++i]);
+			if(i + 1 < argc && isdigit(args[i + 1][0])) encoderEdges = atof(args[++i]);
+		} else if(arg == "--poll" && i + 1 < argc) {
+			pollMicros = atoll(args[++i]);
+		} else if(arg == "--recorder" && i + 1 < argc) {
+			recording = args[++i];
+		} else if(arg == "--socket") {
+			socketPath = (i + 1 < argc && args[i + 1][0] != '-') ? args[++i] : "jacobian.sock";
+		} else if(arg == "--bench") {
+			benchmark = true;
+			if(i + 1 < argc && isdigit(args[i + 1][0])) benchRates = args[++i];
+			if(i + 1 < argc && isdigit(args[i + 1][0])) benchSeconds = atof(args[++i]);
+		} else log("Error", "Unknown option: " + arg);
+	}
+	
+	if(!chipPath.empty()) gpio.reset(new ChardevGPIO(chipPath, !lineOffsets));
+	else if(lineOffsets) log("Warning", "--line-offsets only applies with --gpiochip, so it was ignored.");
+	if(pollMicros > 0 && !chipPath.empty()) log("Warning", "--poll does not apply with --gpiochip, which reports edges, so it was ignored.");
+	if(benchmark) gpio.reset(new SimulatedGPIO());
+	
+	// Start the flight recorder first, so it sees the controller start and the first setpoints.
+	static FlightRecorder flight(recording);
+	FlightRecorder::install(&flight);
+	recorder = &flight;
+	
 	// Init controller...
-	static Controller c("pi3b");
-	c.configurePin(2, "drive", OUTPUT, 1);
-	c.configurePin(4, "steer", OUTPUT, 1);
-	c.configurePin(25, "override", OUTPUT, 1);
+	static Controller c("pi3b", gpio.get());
+	PinHandle drivePin = c.configurePin(2, "drive", OUTPUT, 1),
+		steerPin = c.configurePin(4, "steer", OUTPUT, 1),
+		overridePin = c.configurePin(25, "override", OUTPUT, 1);
+	PinHandle receiverDriveIn, receiverSteerIn;
+	if(receiverDrivePin >= 0) {
+		receiverDriveIn = c.configurePin(receiverDrivePin, "receiver drive", INPUT, PUD_DOWN);
+		receiverSteerIn = c.configurePin(receiverSteerPin, "receiver steer", INPUT, PUD_DOWN);
+	}
+	PinHandle encoderIn;
+	if(encoderPin >= 0) 
+		encoderIn = c.configurePin(encoderPin, "encoder", INPUT, PUD_UP);
 	
 	// Init PWM channels...
-	static PWM driver(60, timeToDutyCycle(60, radixShift(1.5, MILLI))),
-		steer(60, 9.6f);
+	static CarPWM driver(timeToDutyCycle(CarPWM::HZ, radixShift(1.5, MILLI))),
+		steer(9.6f);
+	static PWMScheduler outputs(CarPWM::HZ, 1000, EDGE_SPIN);
+	outputs.attach(c, drivePin, driver);
+	outputs.attach(c, steerPin, steer);
+	
+	// Publish telemetry...
+	static Telemetry telemetry;
+	stats = &telemetry.get();
+	outputs.setTelemetry(stats);
+	
+	// Start the command server, one epoll thread serving every client...
+	thread server;
+	if(!socketPath.empty()) {
+		int listening = openCommandSocket(socketPath);
+		if(listening >= 0) {
+			serving = true;
+			server = thread(serveCommands, listening, socketPath, ref(c), ref(driver), ref(steer), ref(outputs));
+		} else socketPath.clear();
+	}
+	
+	// Start command listener, or the benchmark in its place...
+	thread listener;
+	if(benchmark) 
+		listener = thread(benchEndToEnd, ref(*(SimulatedGPIO *)gpio.get()), steerPin, benchRates, benchSeconds, socketPath, 
+			ref(c), ref(driver), ref(steer), ref(outputs));
+	else listener = thread(command, ref(c), ref(driver), ref(steer), ref(outputs));
 	
-	// Start command listener...
-	thread listener(command, ref(c), ref(driver), ref(steer));
+	// Start decoding the receiver. Edges are captured on their own thread so that the output loop never waits on them.
+	if(pollMicros > 0) c.setPollInterval(pollMicros * 1000);
+	if(receiverDriveIn.valid() && receiverSteerIn.valid()) {
+		receiverWired = c.watchEdges(receiverDriveIn, receiverDrive) && c.watchEdges(receiverSteerIn, receiverSteer);
+		if(!receiverWired) log("Error", "Could not watch the receiver pins.");
+	}
+	if(encoderIn.valid()) {
+		static EdgeCounter counter(encoderEdges);
+		if(c.watchEdges(encoderIn, counter)) encoder = &counter;
+		else log("Error", "Could not watch the encoder pin.");
+	}
+	
+	// Only this (output) thread becomes real-time, so it is done after the listener has started.
+	if(realtime) {
+		RealtimeStatus rt = makeRealtime(rtCpu, rtPriority);
+		log("Real-time", string("Real-time mode: affinity ") + (rt.pinned ? "on" : "off") 
+			+ ", SCHED_FIFO " + (rt.fifo ? "on" : "off") + ", memory lock " + (rt.locked ? "on" : "off") + ".");
+	}
 
 	// Main loop...
 	while(c.isRunning()) {
+		stats->iterations.fetch_add(1, memory_order_relaxed);
 		if(!c.isOverridden()) {
-			driver.tick();
-			steer.tick();
-			c.setPin("drive", driver.eval());
-			c.setPin("steer", steer.eval());
-			if(c.readPin("override") != 1) 
-				c.setPin("override", 1);
+			// Sleep until the next edge of any channel and write it.
+			outputs.service(c);
+			if(c.readPin(overridePin) != 1) 
+				c.setPin(overridePin, 1);
 		} else {
-			if(c.readPin("override") != 0) 
-				c.setPin("override", 0);
+			if(c.readPin(overridePin) != 0) 
+				c.setPin(overridePin, 0);
+			// The physical transmitter has control. Sleep until it is taken back or JacobianOS stops.
+			stats->overrides.fetch_add(1, memory_order_relaxed);
+			c.waitForControl();
+			outputs.restart();
 		}
 	}
 
 	// Kill all processes.
 	c.kill();
-	listener.join();
+	if(server.joinable()) server.join();
+	// Stop called off any routine, so its thread is only returning.
+	thread routine;
+	{
+		lock_guard<mutex> lock(commandLock);
+		cancelRoutine();
+		routine = move(routineThread);
+	}
+	if(routine.joinable()) routine.join();
+	// Stopped from the command server, the console is still waiting for a line, which it is left to.
+	for(int i = 0; i < 100 && !benchmark && !consoleDone; i++) this_thread::sleep_for(chrono::milliseconds(1));
+	if(benchmark || consoleDone) listener.join();
+	else listener.detach();
 
 	return 0;
 }
@@ -0,0 +1,970 @@
+/**
+ * jacobiantest is an external software utility included in JacobianOS that checks the Jacobian
+ * library against stand-ins for the hardware it drives, so it runs on any Linux machine: the GPIO
+ * register block is mapped from an ordinary file, and the GPIO character device is answered by a
+ * fake chip in this program (and by a gpio-sim chip too, where the kernel has one), and hardware PWM
+ * is pointed at a fake sysfs tree. The receiver and encoder decoders are fed synthetic edges, and PWM
+ * setpoints are published from several threads at once. JacobianOS Routine Scripts are compiled with
+ * the compiler JacobianOS uses. Every check is printed as it runs, and the exit status is the number
+ * that failed.
+ *
+ * @author Ian Wilkey (iwilkey)
+ * @since Jacobian 1.5.0, JacobianOS 1.2.0
+ * @version 1.0.0
+ *
+ * Compilation: g++ -DJACOBIAN_NO_WIRINGPI ../../jacobian.cpp ../jors.cpp jacobiantest.cpp -o jacobiantest -pthread -std=c++17
+ * Usage: ./jacobiantest
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/gpio.h>
+#include "../../jacobian.h"
+#include "../jors.h"
+using namespace std;
+using namespace jacobian;
+
+// How many checks have run, and how many failed.
+int checks = 0, failures = 0;
+
+// Heap allocations made by the whole of jacobiantest, counted by the malloc() below.
+atomic<unsigned long long> allocations(0);
+
+// Count every allocation, from operator new or from C, on its way to glibc's own malloc().
+extern "C" void * __libc_malloc(size_t);
+extern "C" void * malloc(size_t size) {
+	allocations.fetch_add(1, memory_order_relaxed);
+	return __libc_malloc(size);
+}
+
+/**
+ * Count and print the outcome of one check.
+ *
+ * @params
+ * 	bool passed: Did the check pass?
+ * 	string what: What was checked.
+ */
+void check(bool passed, string what) {
+	checks++;
+	if(!passed) failures++;
+	cout << ((passed) ? "pass  " : "FAIL  ") << what << endl;
+	return;
+}
+
+// Return the size of a file, or -1 if it does not exist.
+long long fileSize(string path) {
+	struct stat info;
+	return (stat(path.c_str(), &info) == 0) ? (long long)info.st_size : -1;
+}
+
+/**
+ * Write a string to a file, as one write.
+ *
+ * @params
+ * 	string path: The file.
+ * 	string text: What to write.
+ * @return true if it was written.
+ */
+bool put(string path, string text) {
+	ofstream out(path);
+	out << text;
+	out.close();
+	return !out.fail();
+}
+
+// Return the first line of a file, or "" if it cannot be read.
+string get(string path) {
+	ifstream in(path);
+	string line;
+	getline(in, line);
+	return line;
+}
+
+/*******************
+Memory-mapped GPIO
+/*******************/
+
+/**
+ * Map the register block from a file and check every register write against the BCM2835 layout.
+ * wiringPi pins 0, 1, 6, 7 and 8 are BCM GPIO 17, 18, 25, 4 and 2.
+ *
+ * @params
+ * 	string dir: A scratch directory.
+ */
+void testMappedGPIO(string dir) {
+	cout << endl << "Memory-mapped GPIO" << endl;
+	string path = dir + "/gpiomem";
+	MappedGPIO gpio(path);
+	check(gpio.init(), "maps a register block from an ordinary file");
+	check(fileSize(path) == (long long)MappedGPIO::BLOCK_SIZE, "grows the file to a whole register block");
+	volatile uint32_t * registers = gpio.getRegisters();
+
+	registers[MappedGPIO::GPFSEL0 + 1] = 0;
+	gpio.setMode(1, OUTPUT);
+	check(registers[MappedGPIO::GPFSEL0 + 1] == 1u << 24, "OUTPUT sets function 001 in GPIO 18's GPFSEL1 bits");
+	gpio.setMode(1, PWM_OUTPUT);
+	check(registers[MappedGPIO::GPFSEL0 + 1] == 2u << 24, "PWM_OUTPUT selects ALT5 on GPIO 18");
+	registers[MappedGPIO::GPFSEL0 + 1] = 0xFFFFFFFF;
+	gpio.setMode(1, INPUT);
+	check(registers[MappedGPIO::GPFSEL0 + 1] == ~(7u << 24), "INPUT clears only GPIO 18's bits");
+
+	registers[MappedGPIO::GPSET0] = registers[MappedGPIO::GPCLR0] = 0;
+	gpio.write(0, 1);
+	check(registers[MappedGPIO::GPSET0] == 1u << 17 && registers[MappedGPIO::GPCLR0] == 0, "logic HIGH is one store to GPSET0");
+	gpio.write(0, 0);
+	check(registers[MappedGPIO::GPCLR0] == 1u << 17, "logic LOW is one store to GPCLR0");
+
+	registers[MappedGPIO::GPSET0] = registers[MappedGPIO::GPCLR0] = 0;
+	gpio.writeMask((1ULL << 0) | (1ULL << 7), 1ULL << 8);
+	check(registers[MappedGPIO::GPSET0] == ((1u << 17) | (1u << 4)), "a set mask is translated to BCM and written together");
+	check(registers[MappedGPIO::GPCLR0] == 1u << 2, "a clear mask is translated to BCM and written together");
+	registers[MappedGPIO::GPSET0] = 0x5a5a5a5a;
+	gpio.writeMask(0, 1ULL << 8);
+	check(registers[MappedGPIO::GPSET0] == 0x5a5a5a5a, "an empty set mask writes nothing to GPSET0");
+
+	registers[MappedGPIO::GPLEV0] = 1u << 25;
+	check(gpio.read(6) == 1 && gpio.read(0) == 0, "levels are read from GPLEV0");
+	check(gpio.read(40) == -1, "a pin with no GPIO reads as -1");
+
+	gpio.setPud(0, PUD_UP);
+	check(registers[MappedGPIO::GPPUD] == 0 && registers[MappedGPIO::GPPUDCLK0] == 0,
+		"the pull resistor sequence leaves GPPUD and GPPUDCLK0 released");
+
+	// The same writes through a Controller, which shadows the levels it set.
+	Controller c("jacobiantest", &gpio);
+	PinHandle out = c.configurePin(7, "out", OUTPUT, PUD_OFF);
+	check(((registers[MappedGPIO::GPFSEL0] >> 12) & 7) == 1, "configurePin() makes GPIO 4 an output");
+	registers[MappedGPIO::GPSET0] = 0;
+	c.setPin(out, 1);
+	check(registers[MappedGPIO::GPSET0] == 1u << 4, "Controller::setPin() stores to GPSET0");
+	registers[MappedGPIO::GPSET0] = 0;
+	c.setPin(out, 1);
+	check(registers[MappedGPIO::GPSET0] == 0, "a write that changes nothing never reaches the registers");
+	c.kill();
+	check(((registers[MappedGPIO::GPFSEL0] >> 12) & 7) == 0, "kill() returns the pin to an input");
+
+	// Under /dev only the real device will do; nothing may be created in its place.
+	string device = "/dev/jacobiantest-gpiomem";
+	MappedGPIO missing(device);
+	check(!missing.init() && fileSize(device) < 0, "a missing device under /dev fails and is not created");
+	return;
+}
+
+/*******************
+Hardware PWM
+/*******************/
+
+// Make a fake sysfs PWM channel directory with empty period, duty_cycle and enable files.
+void makeChannel(string path) {
+	mkdir(path.c_str(), 0755);
+	for(string file : { "period", "duty_cycle", "enable" }) ofstream(path + "/" + file).close();
+	return;
+}
+
+/**
+ * Point HardwarePWM at a fake sysfs tree and check which files it writes, then check that the
+ * scheduler offloads a pin that has a hardware channel, falls back to software for one that does not
+ * (or whose channel cannot be opened), and sets each pin's mode to match. The pins are on a register
+ * file, so their modes can be read back: wiringPi pin 1 is GPIO 18 (hardware channel 0), pin 0 is
+ * GPIO 17 and pin 26 is GPIO 12 (also channel 0).
+ *
+ * @params
+ * 	string dir: A scratch directory.
+ */
+void testHardwarePWM(string dir) {
+	cout << endl << "Hardware PWM (fake sysfs)" << endl;
+	string root = dir + "/pwm",
+		chip = root + "/pwmchip0",
+		channel = chip + "/pwm0";
+	mkdir(root.c_str(), 0755);
+	mkdir(chip.c_str(), 0755);
+	ofstream(chip + "/export").close();
+	makeChannel(channel);
+
+	int number, line;
+	check(HardwarePWM::channelOf(1, number, line) && number == 0 && line == 0, "GPIO 18 is pwmchip0 channel 0");
+	check(HardwarePWM::channelOf(24, number, line) && line == 1, "GPIO 19 is channel 1");
+	check(!HardwarePWM::channelOf(0, number, line), "GPIO 17 has no hardware channel");
+	{
+		HardwarePWM pwm(0, 0, root);
+		check(pwm.open(), "opens an exported channel");
+		check(get(chip + "/export") == "", "an exported channel is not exported again");
+		pwm.update(16666666, 1500000);
+		check(get(channel + "/period") == "16666666" && get(channel + "/duty_cycle") == "1500000", "period and duty_cycle are written in ns");
+		check(get(channel + "/enable") == "1", "the channel is enabled once it has a signal");
+		put(channel + "/period", "untouched");
+		put(channel + "/enable", "untouched");
+		pwm.update(16666666, 1600000);
+		check(get(channel + "/duty_cycle") == "1600000", "a new pulse width is written");
+		check(get(channel + "/period") == "untouched" && get(channel + "/enable") == "untouched", "files whose value did not change are not written");
+		pwm.update(10000000, 1000000);
+		check(get(channel + "/period") == "10000000" && get(channel + "/duty_cycle") == "1000000", "a shorter period takes the pulse width with it");
+		pwm.disable();
+		check(get(channel + "/enable") == "0", "disable() turns the channel off");
+	}
+	{
+		HardwarePWM pwm(0, 1, root);
+		check(!pwm.open() && get(chip + "/export") == "1", "an unexported channel is exported, and fails if it never appears");
+	}
+
+	string registerFile = dir + "/gpiomem-pwm";
+	MappedGPIO gpio(registerFile);
+	gpio.init();
+	volatile uint32_t * registers = gpio.getRegisters();
+	Controller c("jacobiantest", &gpio);
+	PinHandle hardware = c.configurePin(1, "hardware", OUTPUT, PUD_OFF),
+		software = c.configurePin(0, "software", PWM_OUTPUT, PUD_OFF);
+	PWM offloaded(60, 9.0f), generated(60, 9.0f);
+	offloaded.setPulseWidth(chrono::microseconds(1500));
+	PWMScheduler scheduler(60);
+	scheduler.setHardwareRoot(root);
+	check(scheduler.attach(c, hardware, offloaded), "a channel on GPIO 18 attaches");
+	check(((registers[MappedGPIO::GPFSEL0 + 1] >> 24) & 7) == 2, "its pin is handed to the PWM peripheral (ALT5)");
+	check(get(channel + "/period") == "16666666" && get(channel + "/duty_cycle") == "1500000" && get(channel + "/enable") == "1",
+		"and the hardware channel takes over its signal");
+	check(scheduler.attach(c, software, generated), "a channel on GPIO 17 attaches");
+	check(((registers[MappedGPIO::GPFSEL0 + 1] >> 21) & 7) == 1, "it is generated in software, so its pin is made an OUTPUT");
+
+	offloaded.setPulseWidth(chrono::microseconds(1250));
+	for(long long end = monotonicNanos() + 100000000LL; monotonicNanos() < end && get(channel + "/duty_cycle") != "1250000"; )
+		scheduler.service(c);
+	check(get(channel + "/duty_cycle") == "1250000", "a new setpoint reaches the hardware channel at the next period");
+
+	PinHandle fallback = c.configurePin(26, "fallback", PWM_OUTPUT, PUD_OFF);
+	PWM unplugged(60, 9.0f);
+	PWMScheduler bare(60);
+	bare.setHardwareRoot(dir + "/no-pwm");
+	check(bare.attach(c, fallback, unplugged), "GPIO 12 attaches where its hardware channel cannot be opened");
+	check(((registers[MappedGPIO::GPFSEL0 + 1] >> 6) & 7) == 1, "so it falls back to software, and its pin is made an OUTPUT");
+	c.kill();
+	check(get(channel + "/enable") == "0", "killing the controller turns the hardware channel off");
+	return;
+}
+
+/*******************
+PWM setpoints
+/*******************/
+
+/**
+ * Check that FixedPWM's period is worked out at compile time in its own timebase, that integer
+ * setpoints in ticks reach latch() unchanged, and that a scheduler takes it as a channel only at
+ * its own frequency.
+ * 
+ * @params
+ * 	string dir: The scratch directory.
+ */
+void testFixedPWM(string dir) {
+	cout << endl << "Fixed PWM (" << dir << ")" << endl;
+	typedef FixedPWM<50, 1000000> Servo; // 50hz in microseconds.
+	static_assert(Servo::PERIOD == 20000 && Servo::NANOS_PER_TICK == 1000 && Servo::PERIOD_NANOS == 20000000,
+		"FixedPWM period constants");
+	Servo servo(7.5f);
+	check(servo.getPeriod() == Servo::PERIOD_NANOS, "the period is 20000 ticks of 1us");
+	servo.setHighTime(1500);
+	check(servo.latch() == 1500000 && servo.getHighTicks() == 1500, "a 1500 tick setpoint latches as 1.5ms");
+	servo.setHighTime(30000);
+	check(servo.latch() == Servo::PERIOD_NANOS, "a setpoint past the period is clamped to it");
+
+	MappedGPIO gpio(dir + "/gpiomem-fixed");
+	gpio.init();
+	Controller c("jacobiantest", &gpio);
+	PinHandle pin = c.configurePin(17, "fixed", OUTPUT, PUD_OFF);
+	PWMScheduler scheduler(Servo::HZ);
+	scheduler.setHardwareRoot("");
+	FixedPWM<60> other(9.0f);
+	check(scheduler.attach(c, pin, servo), "a scheduler at 50hz takes a FixedPWM<50> channel");
+	check(!scheduler.attach(c, pin, other), "and refuses a FixedPWM<60> channel");
+	c.kill();
+	return;
+}
+
+/**
+ * Check how latch() evaluates ramps, curves and sequences, at chosen times from the start of each
+ * profile, without waiting for any of them to play out.
+ */
+void testRampLatch(void) {
+	cout << endl << "PWM ramps and sequences" << endl;
+	const long long MS = 1000000;
+	PWM pwm(60, 9.0f);
+	PulseSegment linear = { chrono::microseconds(1000), chrono::microseconds(2000), chrono::seconds(1), RAMP_LINEAR };
+	long long start = pwm.sequencePulseWidth(&linear, 1);
+	check(pwm.latch(start - 5 * MS) == 1000000 && pwm.latch(start) == 1000000, "a ramp starts from its first pulse width");
+	check(pwm.latch(start + 250 * MS) == 1250000 && pwm.latch(start + 500 * MS) == 1500000, 
+		"a linear ramp is a quarter and half way there at a quarter and half its length");
+	check(pwm.latch(start + 1000 * MS) == 2000000 && pwm.latch(start + 60000 * MS) == 2000000, "and holds its end value once over");
+
+	PulseSegment smooth = { chrono::microseconds(1000), chrono::microseconds(2000), chrono::seconds(1), RAMP_SMOOTH };
+	start = pwm.sequencePulseWidth(&smooth, 1);
+	long long quarter = pwm.latch(start + 250 * MS), half = pwm.latch(start + 500 * MS), 
+		late = pwm.latch(start + 750 * MS);
+	check(quarter == 1156250 && half == 1500000 && late == 1843750, "a smooth curve eases in and out (" + to_string(quarter) 
+		+ ", " + to_string(half) + ", " + to_string(late) + "ns at 1/4, 1/2 and 3/4)");
+	check(pwm.latch(start + 1000 * MS) == 2000000, "and ends on its end value");
+
+	PulseSegment sequence[] = {
+		{ chrono::microseconds(1050), chrono::microseconds(1050), chrono::seconds(1), RAMP_LINEAR },
+		{ chrono::microseconds(1500), chrono::microseconds(2000), chrono::milliseconds(500), RAMP_LINEAR },
+		{ chrono::microseconds(1200), chrono::microseconds(1200), chrono::nanoseconds(0), RAMP_LINEAR }
+	};
+	long long last = pwm.sequencePulseWidth(sequence, 3);
+	start = last - 1500 * MS;
+	check(pwm.latch(start + 999 * MS) == 1050000, "a sequence holds its first segment for its length");
+	check(pwm.latch(start + 1000 * MS) == 1500000 && pwm.latch(start + 1250 * MS) == 1750000, 
+		"then ramps along its second from the moment the first is over");
+	check(pwm.latch(last) == 1200000 && pwm.latch(last + 60000 * MS) == 1200000, "and holds its last segment from the time it returned");
+	check(pwm.getHighTime() == 1200000, "latch() leaves the pulse width it worked out for the period");
+
+	// A JORS curve step starts its ramp when it is carried out, so its start is only known to within the call.
+	JORSProgram program;
+	istringstream script("curve steer 1200 2000 1\n");
+	compileJORS(script, program);
+	PWM drive(60, 9.0f), steer(60, 9.0f);
+	bool dlog = false, reverse = false;
+	long long before = monotonicNanos();
+	executeJORS(program.steps[0], dlog, reverse, drive, steer);
+	long long after = monotonicNanos(), middle = steer.latch(after + 500 * MS - (after - before) / 2);
+	check(llabs(middle - 1600000) <= 1000 + (after - before), "a compiled curve step ramps the steering through its midpoint half way ("
+		+ to_string(middle) + "ns)");
+	return;
+}
+
+/**
+ * Publish setpoints to one PWM from several threads at once while this thread latches it as the
+ * output thread would, and check that no latch ever sees a torn setpoint. Each writer publishes
+ * ramps (and two-part sequences, some queued) across one narrow band of pulse widths, and the bands
+ * are far apart, so a latch that mixed the parts of two setpoints lands between bands. The PWM
+ * drives no pin.
+ */
+void testSetpointHandoff(void) {
+	cout << endl << "PWM setpoint handoff (4 writers, 1 second)" << endl;
+	const int writers = 4;
+	const long long base = 1000000, // Where the lowest band starts (ns).
+		band = 200000, // Distance between the writers' bands (ns).
+		width = 50000; // Width of each band (ns).
+	PWM pwm(60, 10.0f);
+	pwm.setPulseWidth(chrono::nanoseconds(base));
+	atomic<bool> done(false);
+	atomic<long long> writes(0);
+	vector<thread> threads;
+	for(int w = 0; w < writers; w++) {
+		threads.emplace_back([&, w]() {
+			chrono::nanoseconds low(base + w * band), high(base + w * band + width);
+			long long n = 0;
+			for(; !done.load(memory_order_relaxed); n++) {
+				if(n & 1) {
+					PulseSegment steps[] = {
+						{ high, low, chrono::nanoseconds(3000), RAMP_SMOOTH },
+						{ low, high, chrono::nanoseconds(7000), RAMP_LINEAR }
+					};
+					pwm.sequencePulseWidth(steps, 2, n & 2);
+				} else pwm.rampPulseWidth(low, high, chrono::nanoseconds(5000 + n % 5000));
+			}
+			writes.fetch_add(n, memory_order_relaxed);
+		});
+	}
+	long long latches = 0, torn = 0,
+		end = monotonicNanos() + PWM::NANOS_PER_SECOND;
+	for(long long now = monotonicNanos(); now < end; now = monotonicNanos(), latches++) {
+		long long high = pwm.latch(now);
+		if(high < base || high > base + (writers - 1) * band + width || (high - base) % band > width) torn++;
+	}
+	done = true;
+	for(thread & t : threads) t.join();
+	check(writes.load() > 0 && latches > 0, to_string(writes.load()) + " setpoints published and " + to_string(latches) + " latched");
+	check(torn == 0, "no latch saw a torn setpoint (" + to_string(torn) + " torn)");
+	return;
+}
+
+/*******************
+Edge decoding
+/*******************/
+
+// Feed one synthetic edge on pin 0 to a sink.
+void feed(EdgeSink & sink, bool rising, long long timestamp) {
+	EdgeEvent edge = { 0, rising, timestamp };
+	sink.edge(edge);
+	return;
+}
+
+/**
+ * Feed PulseDecoder synthetic receiver edges and check the widths and frames it decodes, the
+ * pulses it rejects as glitches or dropouts, and what it does when its consumer falls behind.
+ */
+void testPulseDecoder(void) {
+	cout << endl << "Pulse decoding (synthetic edges)" << endl;
+	const long long start = 1000000000LL, frame = 20000000LL; // 50 Hz frames.
+	PulseDecoder decoder;
+	PulseDecoder::Pulse pulse;
+	check(!decoder.latest(pulse) && !decoder.pop(pulse), "nothing is decoded before the first pulse");
+	feed(decoder, false, start - 100000);
+	check(!decoder.pop(pulse), "a falling edge with no rising edge before it is ignored");
+	feed(decoder, true, start);
+	feed(decoder, false, start + 1500000);
+	check(decoder.pop(pulse) && pulse.width == 1500000 && pulse.frame == 0 && pulse.timestamp == start + 1500000,
+		"a 1.5 ms pulse is decoded, with no frame before the first");
+	feed(decoder, true, start + frame);
+	feed(decoder, false, start + frame + 1000000);
+	check(decoder.pop(pulse) && pulse.width == 1000000 && pulse.frame == frame, "the next pulse has its width and the 20 ms frame");
+	check(decoder.latest(pulse) && pulse.width == 1000000, "and is published as the latest pulse");
+	feed(decoder, true, start + 2 * frame);
+	feed(decoder, false, start + 2 * frame + 100000);
+	check(!decoder.pop(pulse), "a 100 us glitch is rejected");
+	feed(decoder, true, start + 3 * frame);
+	feed(decoder, false, start + 3 * frame + 3000000);
+	check(!decoder.pop(pulse), "a 3 ms pulse is rejected");
+	check(decoder.latest(pulse) && pulse.width == 1000000, "and neither replaces the latest pulse");
+	feed(decoder, true, start + 4 * frame);
+	feed(decoder, true, start + 4 * frame + 500000);
+	feed(decoder, false, start + 4 * frame + 2000000);
+	check(decoder.pop(pulse) && pulse.width == 1500000, "after a lost falling edge the width runs from the latest rising edge");
+
+	PulseDecoder behind;
+	const int extra = 5;
+	for(int i = 0; i < (int)PulseDecoder::CAPACITY + extra; i++) {
+		feed(behind, true, start + i * frame);
+		feed(behind, false, start + i * frame + 1000000 + i * 1000);
+	}
+	check(behind.getOverruns() == extra, "pulses beyond a full ring are counted as overruns");
+	int queued = 0;
+	bool oldestFirst = behind.pop(pulse) && pulse.width == 1000000;
+	for(queued = (oldestFirst) ? 1 : 0; behind.pop(pulse); queued++);
+	check(oldestFirst && queued == (int)PulseDecoder::CAPACITY, "the ring keeps the oldest pulses, in order");
+	check(behind.latest(pulse) && pulse.width == 1000000 + (PulseDecoder::CAPACITY + extra - 1) * 1000,
+		"while the latest pulse is still the newest one");
+	return;
+}
+
+/**
+ * Feed EdgeCounter a synthetic 1 kHz encoder, for longer than its history, and check its count
+ * and the rates it estimates over different windows.
+ */
+void testEdgeCounter(void) {
+	cout << endl << "Edge counting (synthetic edges)" << endl;
+	const long long start = 1000000000LL, period = 1000000LL; // 1 kHz.
+	const int edges = 3 * EdgeCounter::HISTORY + 10;
+	EdgeCounter rising(20), both(20, true);
+	check(rising.getRate(period * 100, start) == 0 && rising.getLastEdge() == -1, "no rate before any edges");
+	for(int i = 0; i < edges; i++) {
+		long long rose = start + i * period;
+		feed(rising, true, rose);
+		feed(rising, false, rose + period / 4);
+		feed(both, true, rose);
+		feed(both, false, rose + period / 2);
+	}
+	long long last = start + (edges - 1) * period;
+	check(rising.getCount() == edges && rising.getLastEdge() == last, "rising edges are counted and falling ones are not");
+	check(both.getCount() == 2 * edges, "both edges are counted when asked");
+	check(rising.getRate(100 * period, last) == 1000, "1 kHz over a 100 ms window");
+	check(rising.getRate(PWM::NANOS_PER_SECOND, last) == 1000, "1 kHz over a window longer than the history");
+	check(rising.getRPM(100 * period, last) == 3000, "3000 RPM at 20 edges per revolution");
+	check(both.getRate(100 * period, last + period / 2) == 2000, "2 kHz counting both edges");
+	check(rising.getRate(10 * period, last + 20 * period) == 0, "0 once the latest edge is older than the window");
+	return;
+}
+
+/*******************
+Telemetry
+/*******************/
+
+// Check that the latency histogram's buckets reach 2^40ns, and that values past them are counted as overflows.
+void testLatencyHistogram(void) {
+	cout << endl << "Latency histogram" << endl;
+	static LatencyHistogram histogram; // Too big for the stack, and starts zeroed.
+	histogram.reset();
+	check(LatencyHistogram::lowerBound(LatencyHistogram::BUCKETS) == LatencyHistogram::RANGE 
+		&& LatencyHistogram::RANGE == (1LL << 40), "the buckets end at 2^40ns");
+	histogram.record(1000);
+	histogram.record(LatencyHistogram::RANGE - 1);
+	check(histogram.overflows.load() == 0, "values inside the range are not overflows");
+	histogram.record(LatencyHistogram::RANGE);
+	histogram.record(1LL << 50);
+	check(histogram.overflows.load() == 2 && histogram.count.load() == 4, "values past it are counted as overflows (" 
+		+ to_string(histogram.overflows.load()) + ")");
+	check(histogram.percentile(0.5) >= 1000 && histogram.percentile(0.5) < LatencyHistogram::RANGE, "and do not move the median");
+	return;
+}
+
+/*******************
+JacobianOS Routine Script
+/*******************/
+
+/**
+ * Compile a script given as text.
+ * 
+ * @params
+ * 	string script: The script.
+ * 	JORSProgram program (reference): Filled in with the compiled routine.
+ * @return the number of errors found.
+ */
+int compile(string script, JORSProgram & program) {
+	istringstream in(script);
+	return compileJORS(in, program);
+}
+
+/**
+ * Check that a script compiles to the steps it says, each due at the sum of the waits before it
+ * (ramps take no time on the timeline), and that every bad line is counted while blank lines are not.
+ */
+void testJORSCompiler(void) {
+	cout << endl << "JORS compiler" << endl;
+	JORSProgram program;
+	int errors = compile("drive f 50\r\nwait 1.5\n\nsteer 1600\nramp drive f 50 80 2\nwait 0.25\ncurve steer 1200 2000 1\n"
+		"wait 0.000001\nbreak\nlog done\n", program);
+	const JORSStep * steps = program.steps.data();
+	check(errors == 0 && program.steps.size() == 9, "a script of 9 steps, a blank line and a CRLF compiles (" 
+		+ to_string(errors) + " errors, " + to_string(program.steps.size()) + " steps)");
+	if(program.steps.size() == 9) {
+		check(steps[0].op == JORS_DRIVE_FORWARD && steps[0].percent == 50 && steps[0].pulse == DRIVE_FORWARD[50] 
+			&& steps[0].at == 0 && steps[0].line == 1, "drive f 50 is due at once, with its pulse width worked out");
+		check(steps[2].op == JORS_STEER && steps[2].at == 1500000000LL && steps[2].line == 4, 
+			"the step after wait 1.5 is due at 1.5s, and keeps its line number");
+		check(steps[3].op == JORS_RAMP_DRIVE_FORWARD && steps[3].from == 50 && steps[3].pulse == DRIVE_FORWARD[80] 
+			&& steps[3].seconds == 2 && steps[3].curve == RAMP_LINEAR && steps[3].at == 1500000000LL, 
+			"a ramp is due with the step before it");
+		check(steps[5].op == JORS_RAMP_STEER && steps[5].curve == RAMP_SMOOTH && steps[5].at == 1750000000LL, 
+			"and takes no time itself: the curve after wait 0.25 is due at 1.75s");
+		check(steps[7].op == JORS_BREAK && steps[7].at == 1750001000LL && steps[8].op == JORS_LOG && steps[8].text == "log done",
+			"due times are absolute, down to a 1us wait");
+	}
+	check(program.length == 1750001000LL, "the routine ends with its last wait (" + to_string(program.length) + "ns)");
+	errors = compile("drive f 101\nsteer 1199\nwait\nramp spin 1 2 3\nbreak now\nfly\ndrive f 10\nwait 2\n", program);
+	check(errors == 6 && program.steps.size() == 2 && program.length == 2000000000LL, 
+		"each of 6 bad lines is an error, and the good lines still compile (" + to_string(errors) + " errors)");
+	return;
+}
+
+/**
+ * Check the streaming parser's handoff to the executor: a script several queues long arrives whole
+ * and in order, a syntax error ends the stream at its line, calling the routine off frees a parser
+ * waiting for room, and steps the parser delivers late are counted as underruns.
+ */
+void testJORSStream(void) {
+	cout << endl << "JORS streaming" << endl;
+	const int lines = 3 * STREAM_AHEAD + 100;
+	string script;
+	for(int i = 0; i < lines; i++) script += "steer " + to_string(STEER_MIN + i % (STEER_MAX - STEER_MIN)) + "\nwait 0.001\n";
+	atomic<bool> cancel(false);
+	// Nothing is due for an hour, so the executor takes steps as fast as the parser queues them.
+	long long future = monotonicNanos() + 3600 * PWM::NANOS_PER_SECOND;
+	{
+		unique_ptr<JORSStream> stream(new JORSStream());
+		thread parser(parseStream, script.data(), script.size(), ref(*stream));
+		JORSStep step;
+		int taken = 0;
+		bool ordered = true;
+		while(takeStream(*stream, future, cancel, step)) {
+			ordered = ordered && step.line == taken + 1 && step.at == taken / 2 * 1000000LL;
+			taken++;
+		}
+		parser.join();
+		check(taken == 2 * lines && ordered, "a script of " + to_string(2 * lines) + " steps arrives whole and in order through a " 
+			+ to_string(STREAM_AHEAD) + " step queue (" + to_string(taken) + " taken)");
+		check(stream->error == nullptr && stream->lines == 2 * lines && stream->length == lines * 1000000LL && stream->underruns == 0,
+			"with no error, its length, and no underruns");
+	}
+	{
+		string broken = script.substr(0, script.size() / 2) + "steer 1\n" + script.substr(script.size() / 2);
+		int bad = lines + 1; // Half the script is lines lines long.
+		unique_ptr<JORSStream> stream(new JORSStream());
+		thread parser(parseStream, broken.data(), broken.size(), ref(*stream));
+		JORSStep step;
+		int taken = 0;
+		while(takeStream(*stream, future, cancel, step)) taken++;
+		parser.join();
+		check(taken == bad - 1 && stream->error != nullptr && stream->errorLine == bad, "a syntax error on line " 
+			+ to_string(bad) + " ends the stream there (" + to_string(taken) + " steps taken)");
+	}
+	{
+		unique_ptr<JORSStream> stream(new JORSStream());
+		thread parser(parseStream, script.data(), script.size(), ref(*stream));
+		for(long long end = monotonicNanos() + PWM::NANOS_PER_SECOND; stream->head.load() < STREAM_AHEAD && monotonicNanos() < end; )
+			this_thread::sleep_for(chrono::milliseconds(1));
+		this_thread::sleep_for(chrono::milliseconds(5));
+		bool waiting = !stream->done.load() && stream->head.load() == STREAM_AHEAD;
+		stream->cancel = true;
+		long long called = monotonicNanos();
+		parser.join();
+		check(waiting && stream->done.load() && monotonicNanos() - called < 100000000LL, 
+			"a parser waiting on a full queue stops as soon as the routine is called off");
+	}
+	{
+		// The executor starts the clock before the parser has begun, so the first step is late.
+		string late = "steer 1500\nwait 10\nsteer 1600\n";
+		unique_ptr<JORSStream> stream(new JORSStream());
+		long long start = monotonicNanos();
+		thread parser([&]() {
+			this_thread::sleep_for(chrono::milliseconds(20));
+			parseStream(late.data(), late.size(), *stream);
+		});
+		JORSStep step;
+		int taken = 0;
+		while(takeStream(*stream, start, cancel, step)) taken++;
+		parser.join();
+		check(taken == 3 && stream->underruns == 1 && stream->starved >= 10000000LL && stream->starved < 10 * PWM::NANOS_PER_SECOND, 
+			"a step the parser delivers after it was due is one underrun, held up for " + to_string(stream->starved / 1000) + "us");
+	}
+	return;
+}
+
+/**
+ * Check the policy for commands given while a drive sequence runs: sequencePulseWidth() queues
+ * behind the sequence or pre-empts it, driveAt() queues going backwards and pre-empts going
+ * forwards, and invokeBreak() calls an arming sequence off. Pulse widths are latched at times
+ * relative to when each sequence started, which driveAt() leaves in armedAt.
+ */
+void testDrivePolicy(void) {
+	cout << endl << "Drive sequence policy" << endl;
+	const long long MS = 1000000, ARMING = chrono::nanoseconds(ARM_BRAKE_HOLD + ARM_RESET_HOLD).count();
+	PWM pwm(60, 9.0f);
+	PulseSegment arm[] = {
+		{ chrono::microseconds(1050), chrono::microseconds(1050), chrono::seconds(1), RAMP_LINEAR },
+		{ chrono::microseconds(1500), chrono::microseconds(1500), chrono::milliseconds(250), RAMP_LINEAR },
+		{ chrono::microseconds(1300), chrono::microseconds(1300), chrono::nanoseconds(0), RAMP_LINEAR }
+	}, next = { chrono::microseconds(1100), chrono::microseconds(1100), chrono::nanoseconds(0), RAMP_LINEAR };
+	long long last = pwm.sequencePulseWidth(arm, 3), queued = pwm.sequencePulseWidth(&next, 1, true);
+	check(queued == last && pwm.latch(last - 1000 * MS) == 1050000 && pwm.latch(last - 100 * MS) == 1500000 
+		&& pwm.latch(last) == 1100000, "a queued setpoint replaces only the last segment of a running sequence");
+	check(pwm.inSequence(), "and the sequence is still running");
+	long long now = monotonicNanos();
+	pwm.sequencePulseWidth(&next, 1);
+	check(pwm.latch(now + MS) == 1100000 && !pwm.inSequence(), "a setpoint that is not queued pre-empts it at once");
+	last = pwm.sequencePulseWidth(arm, 3);
+	pwm.sequencePulseWidth(arm, 3, true);
+	check(pwm.latch(last + ARMING - 1000 * MS) == 1050000, "a sequence queued behind another runs after it");
+
+	PWM drive(60, 9.0f);
+	bool dlog = false, reverse = false;
+	driveAt(true, 40, dlog, reverse, drive);
+	check(drive.latch() == DRIVE_FORWARD[40].count() * 1000 && !reverse, "drive f 40 is its pulse width at once");
+	driveAt(false, 50, dlog, reverse, drive);
+	long long armed = armedAt, started = armed - ARMING;
+	check(reverse && drive.latch(started + 500 * MS) == ARM_BRAKE_PULSE.count() * 1000 
+		&& drive.latch(armed - 100 * MS) == NEUTRAL_PULSE.count() * 1000 && drive.latch(armed) == DRIVE_REVERSE[50].count() * 1000,
+		"going backwards from forwards holds the brake for 1s, neutral for 250ms, then the speed");
+	driveAt(false, 20, dlog, reverse, drive);
+	check(armedAt == armed && drive.latch(started + 500 * MS) == ARM_BRAKE_PULSE.count() * 1000 
+		&& drive.latch(armed) == DRIVE_REVERSE[20].count() * 1000, "drive b 20 while arming queues behind the arming sequence");
+	now = monotonicNanos();
+	driveAt(true, 30, dlog, reverse, drive);
+	check(!reverse && drive.latch(now + MS) == DRIVE_FORWARD[30].count() * 1000, "drive f 30 while arming pre-empts it at once");
+
+	driveAt(false, 50, dlog, reverse, drive);
+	now = monotonicNanos();
+	invokeBreak(reverse, dlog, drive);
+	check(!reverse && drive.latch(now + MS) == NEUTRAL_PULSE.count() * 1000 && drive.latch(now + 2000 * MS) == NEUTRAL_PULSE.count() * 1000,
+		"break while arming calls the arming off and leaves neutral");
+	driveAt(true, 60, dlog, reverse, drive);
+	now = monotonicNanos();
+	invokeBreak(reverse, dlog, drive);
+	check(drive.latch(now + 50 * MS) == FULL_REVERSE_PULSE.count() * 1000 && drive.latch(now + 200 * MS) == NEUTRAL_PULSE.count() * 1000,
+		"break going forwards holds the brake for 100ms, then neutral");
+	reverse = true;
+	armedAt = 0; // Armed long ago, so the car is moving backwards.
+	now = monotonicNanos();
+	invokeBreak(reverse, dlog, drive);
+	check(drive.latch(now + 50 * MS) == REVERSE_BRAKE_PULSE.count() * 1000 && drive.latch(now + 200 * MS) == FULL_REVERSE_PULSE.count() * 1000,
+		"break going backwards holds the reverse brake for 100ms, then full reverse");
+	return;
+}
+
+// Check that splitting, looking up and parsing console commands with the shared parser makes no heap allocation.
+void testParserAllocations(void) {
+	cout << endl << "Console parser allocations" << endl;
+	static const char * const COMMANDS[] = { "drive f 50", "steer 1600", "break", "drive b 30", 
+		"ramp drive f 0 80 2.0", "curve steer 1200 2000 0.5", "override 0", "jitter", "steer 2100", "bogus words here" };
+	long long parsed = 0, refused = 0;
+	unsigned long long before = allocations.load();
+	for(int round = 0; round < 1000; round++) {
+		for(const char * text : COMMANDS) {
+			string_view line = text, 
+				words[MAX_WORDS];
+			size_t count = splitWords(line, words, MAX_WORDS);
+			COMMANDWORD word = lookupWord(words[0]);
+			if(word != WORD_DRIVE && word != WORD_BREAK && word != WORD_STEER && word != WORD_RAMP && word != WORD_CURVE) continue;
+			JORSStep step;
+			long long at = 0;
+			const char * error;
+			if(parseJORSWords(words, count, line, 0, at, step, error)) parsed++;
+			else refused++;
+		}
+	}
+	unsigned long long made = allocations.load() - before;
+	check(parsed == 6000 && refused == 1000, "the commands parse as they should (" + to_string(parsed) + " parsed, " 
+		+ to_string(refused) + " refused)");
+	check(made == 0, "10000 commands are split, looked up and parsed without allocating (" + to_string(made) + " allocations)");
+	return;
+}
+
+// Check that waits and ramps that are not finite, or long enough to overflow the timeline, are syntax errors.
+void testJORSLimits(void) {
+	cout << endl << "JORS wait and ramp limits" << endl;
+	JORSProgram program;
+	check(compile("drive f 10\nwait inf\ndrive f 10\n", program) == 1, "wait inf is a syntax error");
+	check(compile("wait nan\nwait 1e300\nwait -1\n", program) == 3, "so are wait nan, wait 1e300 and a negative wait");
+	check(compile("ramp drive f 0 10 inf\ncurve steer 1200 2000 1e300\n", program) == 2, "and ramps of those lengths");
+	check(compile("wait 1000000\nramp steer 1200 2000 1000000\n", program) == 0 
+		&& program.length == (long long)(MAX_STEP_SECONDS * PWM::NANOS_PER_SECOND), "the longest wait and ramp compile");
+	string longest;
+	for(int i = 0; i < 11; i++) longest += "wait 1000000\n";
+	check(compile(longest, program) == 1 && program.length == MAX_ROUTINE_LENGTH, 
+		"waits that add up past the longest routine are an error, and the timeline stops at its end");
+	return;
+}
+
+/*******************
+GPIO character device
+/*******************/
+
+/**
+ * A fake GPIO chip. This program defines ioctl() itself, so the library's calls land here: the GPIO
+ * uAPI requests made on the chip's stand-in file, or on the line request it hands out, are answered
+ * from this state, and everything else goes on to the kernel. The line request is the read end of a
+ * pipe, so edge events written to the other end reach ChardevGPIO just as the kernel's would.
+ */
+struct FakeChip {
+	dev_t device = 0; // The file standing in for the chip.
+	ino_t inode = 0;
+	int request = -1, // The read end of the pipe handed out as the line request.
+		feed = -1; // The write end, where edge events are pushed in.
+	int requests = 0, reconfigs = 0, sets = 0, gets = 0; // ioctls answered, by kind.
+	gpio_v2_line_request lastRequest; // As of the latest request.
+	gpio_v2_line_config lastConfig; // As of the latest request or reconfiguration.
+	gpio_v2_line_values lastSet;
+	unsigned long long levels = 0; // Line levels, by position in the request.
+} fake;
+
+// Is the descriptor the fake chip's stand-in file?
+bool isFakeChip(int fd) {
+	struct stat info;
+	return fake.inode != 0 && fstat(fd, &info) == 0 && info.st_dev == fake.device && info.st_ino == fake.inode;
+}
+
+extern "C" int ioctl(int fd, unsigned long request, ...) noexcept {
+	va_list args;
+	va_start(args, request);
+	void * arg = va_arg(args, void *);
+	va_end(args);
+	if(request == GPIO_V2_GET_LINE_IOCTL && isFakeChip(fd)) {
+		gpio_v2_line_request * req = (gpio_v2_line_request *)arg;
+		int ends[2];
+		if(pipe2(ends, O_CLOEXEC) != 0) return -1;
+		if(fake.feed >= 0) close(fake.feed);
+		fake.request = req->fd = ends[0];
+		fake.feed = ends[1];
+		fake.lastRequest = *req;
+		fake.lastConfig = req->config;
+		fake.requests++;
+		return 0;
+	}
+	if(fd == fake.request && fd >= 0) {
+		if(request == GPIO_V2_LINE_SET_VALUES_IOCTL) {
+			gpio_v2_line_values * values = (gpio_v2_line_values *)arg;
+			fake.levels = (fake.levels & ~values->mask) | (values->bits & values->mask);
+			fake.lastSet = *values;
+			fake.sets++;
+			return 0;
+		}
+		if(request == GPIO_V2_LINE_GET_VALUES_IOCTL) {
+			gpio_v2_line_values * values = (gpio_v2_line_values *)arg;
+			values->bits = fake.levels & values->mask;
+			fake.gets++;
+			return 0;
+		}
+		if(request == GPIO_V2_LINE_SET_CONFIG_IOCTL) {
+			fake.lastConfig = *(gpio_v2_line_config *)arg;
+			fake.reconfigs++;
+			return 0;
+		}
+	}
+	return syscall(SYS_ioctl, fd, request, arg);
+}
+
+// Return the flags a line config gives the line at a position in the request.
+unsigned long long flagsOf(const gpio_v2_line_config & config, int position) {
+	for(unsigned a = 0; a < config.num_attrs; a++) {
+		if(config.attrs[a].attr.id == GPIO_V2_LINE_ATTR_ID_FLAGS && (config.attrs[a].mask >> position & 1))
+			return config.attrs[a].attr.flags;
+	}
+	return config.flags;
+}
+
+// Return the output values a line config sets, or -1 if it sets none.
+long long outputValuesOf(const gpio_v2_line_config & config) {
+	for(unsigned a = 0; a < config.num_attrs; a++) {
+		if(config.attrs[a].attr.id == GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES) return config.attrs[a].attr.values;
+	}
+	return -1;
+}
+
+// Push an edge event into the fake chip's line request.
+void pushEdge(unsigned offset, bool rising, unsigned long long timestamp) {
+	gpio_v2_line_event event;
+	memset(&event, 0, sizeof(event));
+	event.offset = offset;
+	event.id = (rising) ? GPIO_V2_LINE_EVENT_RISING_EDGE : GPIO_V2_LINE_EVENT_FALLING_EDGE;
+	event.timestamp_ns = timestamp;
+	if(write(fake.feed, &event, sizeof(event)) != sizeof(event)) cerr << "Could not push an edge." << endl;
+	return;
+}
+
+/**
+ * Drive ChardevGPIO against the fake chip and check every request it makes of the uAPI.
+ * wiringPi pins 0, 1 and 7 are BCM lines 17, 18 and 4.
+ *
+ * @params
+ * 	string dir: A scratch directory.
+ */
+void testChardevGPIO(string dir) {
+	cout << endl << "GPIO character device (fake chip)" << endl;
+	string path = dir + "/gpiochip";
+	ofstream(path).close();
+	struct stat info;
+	stat(path.c_str(), &info);
+	fake.device = info.st_dev;
+	fake.inode = info.st_ino;
+
+	ChardevGPIO gpio(path);
+	check(gpio.init(), "opens the chip");
+	gpio.setMode(0, OUTPUT);
+	gpio.setMode(1, OUTPUT);
+	gpio.setMode(7, INPUT);
+	gpio.setPud(7, PUD_UP);
+	check(fake.requests == 0, "configuring pins makes no request yet");
+	gpio.writeMask(1ULL << 0, 1ULL << 1);
+	check(fake.requests == 1 && fake.lastRequest.num_lines == 3, "the first access requests every configured line in one batch");
+	check(fake.lastRequest.offsets[0] == 17 && fake.lastRequest.offsets[1] == 18 && fake.lastRequest.offsets[2] == 4,
+		"wiringPi pins are translated to BCM line offsets");
+	check((flagsOf(fake.lastConfig, 0) & GPIO_V2_LINE_FLAG_OUTPUT) && (flagsOf(fake.lastConfig, 1) & GPIO_V2_LINE_FLAG_OUTPUT),
+		"output pins are requested as outputs");
+	unsigned long long input = flagsOf(fake.lastConfig, 2);
+	check((input & GPIO_V2_LINE_FLAG_INPUT) && (input & GPIO_V2_LINE_FLAG_EDGE_RISING) && (input & GPIO_V2_LINE_FLAG_EDGE_FALLING)
+		&& (input & GPIO_V2_LINE_FLAG_BIAS_PULL_UP), "an input pin reports both edges, with its pull resistor");
+	check(fake.sets == 1 && fake.lastSet.mask == 3 && fake.lastSet.bits == 1, "a set and clear mask is one SET_VALUES ioctl");
+
+	gpio.write(1, 1);
+	check(fake.sets == 2 && fake.lastSet.mask == 2 && fake.lastSet.bits == 2, "a single write sets only its own line");
+	fake.levels |= 1ULL << 2;
+	check(gpio.read(7) == 1, "reads come from GET_VALUES");
+
+	gpio.setPud(7, PUD_DOWN);
+	gpio.write(0, 0);
+	check(fake.requests == 1 && fake.reconfigs == 1, "changing a pull resistor reconfigures the request in place");
+	check(outputValuesOf(fake.lastConfig) == 3, "outputs keep their levels across a reconfiguration");
+	check(flagsOf(fake.lastConfig, 2) & GPIO_V2_LINE_FLAG_BIAS_PULL_DOWN, "the new pull resistor is applied");
+
+	gpio.setMode(8, OUTPUT);
+	gpio.write(8, 1);
+	check(fake.requests == 2 && fake.lastRequest.num_lines == 4 && fake.lastRequest.offsets[3] == 2,
+		"a new pin makes a new request covering every line");
+
+	EdgeEvent edge;
+	check(gpio.edgeFd() == fake.request, "edges are read from the line request");
+	check(!gpio.readEdge(edge), "no edge is reported before there is one");
+	pushEdge(4, true, 1000);
+	pushEdge(4, false, 2500);
+	pushEdge(9, true, 3000);
+	check(gpio.readEdge(edge) && edge.pin == 7 && edge.rising && edge.timestamp == 1000, "a rising edge comes back with its pin and kernel time");
+	check(gpio.readEdge(edge) && edge.pin == 7 && !edge.rising && edge.timestamp == 2500, "then the falling edge");
+	check(gpio.readEdge(edge) && edge.pin == -1, "an edge on a line that was not requested has no pin");
+	check(!gpio.readEdge(edge), "and then there are no more");
+
+	gpio.setMode(8, PWM_OUTPUT);
+	gpio.write(0, 1);
+	check(fake.requests == 3 && fake.lastRequest.num_lines == 3 && fake.lastRequest.offsets[0] == 17 && fake.lastRequest.offsets[1] == 18 
+		&& fake.lastRequest.offsets[2] == 4, "a pin handed to the PWM peripheral is released from the request");
+
+	// Simulated chips number their lines from 0, so pin IDs are used as offsets as they are.
+	ChardevGPIO raw(path, false);
+	raw.init();
+	raw.setMode(2, OUTPUT);
+	raw.setMode(25, OUTPUT);
+	raw.write(2, 1);
+	check(fake.lastRequest.num_lines == 2 && fake.lastRequest.offsets[0] == 2 && fake.lastRequest.offsets[1] == 25,
+		"without translation pin IDs are line offsets");
+	return;
+}
+
+/**
+ * Drive ChardevGPIO against a real gpio-sim chip, if the kernel has the module and configfs is
+ * mounted (modprobe gpio-sim; mount -t configfs none /sys/kernel/config). Needs root. A chip of 32
+ * lines is made for the test and taken down afterwards.
+ */
+void testGpioSim(void) {
+	cout << endl << "GPIO character device (gpio-sim)" << endl;
+	string config = "/sys/kernel/config/gpio-sim/jacobiantest";
+	if(access("/sys/kernel/config/gpio-sim", W_OK) != 0 || (mkdir(config.c_str(), 0755) != 0 && errno != EEXIST)) {
+		cout << "skip  gpio-sim is not available here" << endl;
+		return;
+	}
+	mkdir((config + "/gpio-bank0").c_str(), 0755);
+	put(config + "/gpio-bank0/num_lines", "32");
+	check(put(config + "/live", "1"), "a gpio-sim chip goes live");
+	string chip = get(config + "/gpio-bank0/chip_name"),
+		lines = "/sys/devices/platform/" + get(config + "/dev_name") + "/" + chip + "/sim_gpio";
+	{
+		ChardevGPIO gpio("/dev/" + chip, false);
+		check(gpio.init(), "opens /dev/" + chip);
+		gpio.setMode(3, OUTPUT);
+		gpio.setMode(5, INPUT);
+		gpio.setPud(5, PUD_DOWN);
+		gpio.write(3, 1);
+		check(get(lines + "3/value") == "1", "a write drives the simulated line");
+		gpio.writeMask(0, 1ULL << 3);
+		check(get(lines + "3/value") == "0", "a mask write drives it back");
+
+		int fd = gpio.edgeFd();
+		put(lines + "5/pull", "pull-up");
+		pollfd ready = { fd, POLLIN, 0 };
+		EdgeEvent edge;
+		long long before = monotonicNanos();
+		check(poll(&ready, 1, 1000) == 1 && gpio.readEdge(edge) && edge.pin == 5 && edge.rising, "pulling an input up reports a rising edge");
+		check(edge.timestamp > before - 1000000000LL && edge.timestamp <= monotonicNanos(), "stamped on CLOCK_MONOTONIC");
+		check(gpio.read(5) == 1, "and the input reads logic HIGH");
+		put(lines + "5/pull", "pull-down");
+		check(poll(&ready, 1, 1000) == 1 && gpio.readEdge(edge) && edge.pin == 5 && !edge.rising, "pulling it down reports a falling edge");
+	}
+	put(config + "/live", "0");
+	rmdir((config + "/gpio-bank0").c_str());
+	rmdir(config.c_str());
+	return;
+}
+
+// Main instructions.
+int main(void) {
+	char scratch[] = "/tmp/jacobiantest.XXXXXX";
+	if(mkdtemp(scratch) == nullptr) {
+		cerr << "Could not make a scratch directory." << endl;
+		return 1;
+	}
+	string dir = scratch;
+	// The library's own messages go to a log in the scratch directory, out of the way of the results.
+	setLogConsole(false);
+	setLogFile(dir + "/log.txt");
+
+	testMappedGPIO(dir);
+	testChardevGPIO(dir);
+	testHardwarePWM(dir);
+	testGpioSim();
+	testPulseDecoder();
+	testEdgeCounter();
+	testLatencyHistogram();
+	testJORSCompiler();
+	testJORSLimits();
+	testParserAllocations();
+	testJORSStream();
+	testDrivePolicy();
+	testRampLatch();
+	testFixedPWM(dir);
+	testSetpointHandoff();
+
+	flushLog();
+	cout << endl << checks - failures << " of " << checks << " checks passed. Scratch files are in " << dir << "." << endl;
+	return failures;
+}
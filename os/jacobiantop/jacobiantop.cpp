@@ -0,0 +1,82 @@
+/**
+ * jacobiantop is an external software utility included in JacobianOS that displays the telemetry
+ * of a running JacobianOS live: how fast the output loop goes around, what writing an edge costs,
+ * how late the edges land and how long console commands take. It only maps the telemetry segment
+ * read-only and reads it, so watching it never stops or slows the car.
+ *
+ * @author Ian Wilkey (iwilkey)
+ * @since Jacobian 1.5.0, JacobianOS 1.2.0
+ * @version 1.0.0
+ *
+ * Compilation: g++ -DJACOBIAN_NO_WIRINGPI ../../jacobian.cpp jacobiantop.cpp -o jacobiantop -pthread -std=c++17
+ * Usage: ./jacobiantop [refresh_seconds] [segment_name]
+ */
+
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <signal.h>
+#include "../../jacobian.h"
+using namespace std;
+using namespace jacobian;
+
+/**
+ * Print one row of the latency table, in microseconds, and how many values were past the
+ * histogram's range (2^40ns), so its percentiles only bound them from below.
+ *
+ * @params
+ * 	string name: The name of the row.
+ * 	LatencyHistogram histogram (reference): The histogram to summarise.
+ */
+void row(string name, const LatencyHistogram & histogram) {
+	printf("%-18s %12llu %10.2f %10.2f %10.2f %10.2f %10.2f %10llu\n", name.c_str(),
+		histogram.count.load(memory_order_relaxed), histogram.mean() / 1000.0,
+		histogram.percentile(0.5) / 1000.0, histogram.percentile(0.99) / 1000.0,
+		histogram.percentile(0.999) / 1000.0, histogram.worst.load(memory_order_relaxed) / 1000.0,
+		histogram.overflows.load(memory_order_relaxed));
+	return;
+}
+
+// Main instructions.
+int main(int argc, char ** args) {
+	double refresh = (argc > 1) ? atof(args[1]) : 1.0;
+	string name = (argc > 2) ? args[2] : "/jacobian";
+	if(refresh <= 0) refresh = 1.0;
+
+	const TelemetryBlock * block = Telemetry::attach(name);
+	if(block == nullptr) {
+		cout << "No JacobianOS is publishing telemetry as " << name << "." << endl;
+		return 1;
+	}
+
+	unsigned long long lastIterations = block->iterations.load(memory_order_relaxed),
+		lastEdges = block->edgeLateness.count.load(memory_order_relaxed);
+	while(true) {
+		this_thread::sleep_for(chrono::duration<double>(refresh));
+		// The segment outlives a JacobianOS that was killed, so check that the writer is still there.
+		if(block->magic.load(memory_order_acquire) != TelemetryBlock::MAGIC || kill(block->pid, 0) != 0) {
+			cout << "JacobianOS has stopped." << endl;
+			break;
+		}
+		unsigned long long iterations = block->iterations.load(memory_order_relaxed),
+			edges = block->edgeLateness.count.load(memory_order_relaxed);
+		double uptime = (monotonicNanos() - block->started) / 1e9;
+
+		printf("\033[H\033[2J");
+		printf("jacobiantop - JacobianOS pid %lld, up %.1fs\n\n", block->pid, uptime);
+		printf("Output loop: %.0f iterations/s, %.0f edges/s, %llu overrides. Commands: %llu.\n\n",
+			(iterations - lastIterations) / refresh, (edges - lastEdges) / refresh,
+			block->overrides.load(memory_order_relaxed), block->commands.load(memory_order_relaxed));
+		printf("%-18s %12s %10s %10s %10s %10s %10s %10s\n", "(us)", "count", "mean", "p50", "p99", "p99.9", "max", "overflow");
+		row("tick cost", block->tickCost);
+		row("edge lateness", block->edgeLateness);
+		row("command latency", block->commandLatency);
+		fflush(stdout);
+
+		lastIterations = iterations;
+		lastEdges = edges;
+	}
+
+	Telemetry::detach(block);
+	return 0;
+}
@@ -0,0 +1,511 @@
+/**
+ * JacobianOS Routine Script compiler and drive commands implementation file.
+ *
+ * @author Ian Wilkey (iwilkey)
+ * @since JacobianOS 1.2.0
+ */
+
+#include "jors.h"
+#include <charconv>
+#include <cstring>
+
+/*******************
+Pulse widths
+/*******************/
+
+// When the reverse arming sequence last started is over (CLOCK_MONOTONIC ns), as the output loop will run it.
+long long armedAt = 0;
+
+/*******************
+Drive commands
+/*******************/
+
+/**
+ * Drive the car forwards or backwards at a percentage of its top speed. Going backwards from
+ * forwards first runs the ESC's timed reverse-arming sequence. The output loop runs the sequence
+ * on its own clock, so this returns at once and the next command is never held up by it.
+ * 
+ * Commands given while a drive sequence (arming or braking) is running follow one policy: going
+ * backwards queues behind the sequence and is taken up as soon as it is over, while going forwards
+ * pre-empts it at once. invokeBreak() always pre-empts.
+ * 
+ * @params
+ * 	bool forward: Drive forwards (true) or backwards (false).
+ * 	int percent: The percentage of top speed [0 - 100].
+ * 	bool dlog (reference): The state of the JacobianOS log option (writing output to console).
+ * 	bool reverse (reference): The state of the reverse mode on the car.
+ * 	PWM drive (reference): The actual PWM object connected to the selected GPIO pinout for the drive motor.
+ */
+void driveAt(bool forward, int percent, bool & dlog, bool & reverse, PWM & drive) {
+	percent = (percent > 100) ? 100 : percent;
+	percent = (percent < 0) ? 0 : percent;
+	if(forward) {
+		if(reverse) reverse = false;
+		// Forward implementation.
+		drive.setPulseWidth(DRIVE_FORWARD[percent]);
+		if(dlog)
+			log("Success", "The car is now moving forward at " + to_string(percent) + "% of its top speed. Pulse width in ms: " 
+				+ to_string(DRIVE_FORWARD[percent].count() / 1000.0f));
+		return;
+	}
+	PulseSegment speed = { DRIVE_REVERSE[percent], DRIVE_REVERSE[percent], chrono::nanoseconds(0), RAMP_LINEAR };
+	if(!reverse) {
+		// Backwards implementation.
+		// Needs special timed beginning sequence: hold the brake, pulse neutral, then go.
+		PulseSegment arm[] = {
+			{ ARM_BRAKE_PULSE, ARM_BRAKE_PULSE, ARM_BRAKE_HOLD, RAMP_LINEAR },
+			{ NEUTRAL_PULSE, NEUTRAL_PULSE, ARM_RESET_HOLD, RAMP_LINEAR },
+			speed
+		};
+		armedAt = drive.sequencePulseWidth(arm, 3);
+		reverse = true;
+		if(dlog) 
+			log("Break routine", "Break routine started. The car will move backwards in " 
+				+ to_string((ARM_BRAKE_HOLD + ARM_RESET_HOLD).count()) + "ms.");
+	} else drive.sequencePulseWidth(&speed, 1, true);
+	
+	if(dlog)
+		log("Success", "The car is now moving backwards at " + to_string(percent) + "% of its top speed. Pulse width in ms: " 
+			+ to_string(DRIVE_REVERSE[percent].count() / 1000.0f));
+	return;
+}
+
+/**
+ * Stop car in tracks. The brake is held by the output loop, so this returns at once; any command
+ * given while it is held pre-empts or queues behind it as driveAt() describes.
+ * Command style: break (no args)...
+ * 
+ * @params
+ *  bool reverse (reference): The state of the reverse mode on the car.
+ * 	bool dlog (reference): The state of the JacobianOS log option (writing output to console).
+ * 	PWM drive (reference): The actual PWM object connected to the selected GPIO pinout for the drive motor.
+ */
+void invokeBreak(bool & reverse, bool & dlog, PWM & drive) {
+	if(reverse && monotonicNanos() < armedAt) {
+		// Still arming for reverse, so the car is already held by the brake: call the arming off.
+		drive.setPulseWidth(NEUTRAL_PULSE);
+		reverse = false;
+	} else {
+		chrono::microseconds brake = (reverse) ? REVERSE_BRAKE_PULSE : FULL_REVERSE_PULSE,
+			stopped = (reverse) ? FULL_REVERSE_PULSE : NEUTRAL_PULSE;
+		PulseSegment stop[] = {
+			{ brake, brake, BRAKE_HOLD, RAMP_LINEAR },
+			{ stopped, stopped, chrono::nanoseconds(0), RAMP_LINEAR }
+		};
+		drive.sequencePulseWidth(stop, 2);
+	}
+	if(dlog)
+		log("Success", "The car has stopped moving.");
+	return;
+}
+
+// The command words, indexed by COMMANDWORD.
+static constexpr string_view WORD_NAMES[WORDS] = { "", "help", "log", "load", "stream", "stop", "drive", "break", 
+	"steer", "ramp", "curve", "wait", "override", "jitter", "gpio", "transmitter", "encoder", "bench" };
+
+// The number of slots in the command word hash table.
+#define WORD_SLOTS 32
+
+/**
+ * Hash a command word from its length and its first and last letters. The hash is perfect over
+ * WORD_NAMES (checked at compile time below), so one compare confirms a lookup.
+ * 
+ * @params
+ * 	string_view word: The word.
+ * @return its slot in the hash table [0 - WORD_SLOTS).
+ */
+static constexpr unsigned hashWord(string_view word) {
+	return (word.empty()) ? 0 : (word.size() + 2 * (unsigned char)word.front() + (unsigned char)word.back()) % WORD_SLOTS;
+}
+
+/**
+ * Build the command word hash table at compile time.
+ * 
+ * @return the COMMANDWORD in each slot, or WORD_UNKNOWN for an empty one.
+ */
+static constexpr array<unsigned char, WORD_SLOTS> makeWordTable(void) {
+	array<unsigned char, WORD_SLOTS> table{};
+	for(int word = 1; word < WORDS; word++) table[hashWord(WORD_NAMES[word])] = word;
+	return table;
+}
+
+// The command word hash table, computed at compile time.
+static constexpr array<unsigned char, WORD_SLOTS> WORD_TABLE = makeWordTable();
+
+// Check that no two command words share a slot.
+static constexpr bool wordsArePerfect(void) {
+	for(int word = 1; word < WORDS; word++) 
+		if(WORD_TABLE[hashWord(WORD_NAMES[word])] != word) return false;
+	return true;
+}
+static_assert(wordsArePerfect(), "Two command words share a hash slot; change hashWord() or WORD_SLOTS.");
+
+/**
+ * Look up a command word. This is one hash and one compare, with no allocation.
+ * 
+ * @params
+ * 	string_view word: The word.
+ * @return the COMMANDWORD, or WORD_UNKNOWN.
+ */
+COMMANDWORD lookupWord(string_view word) {
+	COMMANDWORD found = (COMMANDWORD)WORD_TABLE[hashWord(word)];
+	return (WORD_NAMES[found] == word) ? found : WORD_UNKNOWN;
+}
+
+/**
+ * Split a line into words at spaces, without copying or allocating. The words point into the line.
+ * 
+ * @params
+ * 	string_view line: The line.
+ * 	string_view words (pointer): Filled in with the words; the rest are left empty.
+ * 	size_t max: The most words to find.
+ * @return how many words were found [0 - max].
+ */
+size_t splitWords(string_view line, string_view * words, size_t max) {
+	size_t count = 0;
+	for(size_t i = 0; i < max; i++) words[i] = string_view();
+	for(size_t start = 0; start <= line.size() && count < max;) {
+		size_t space = line.find(' ', start);
+		if(space == string_view::npos) space = line.size();
+		if(space > start) words[count++] = line.substr(start, space - start);
+		start = space + 1;
+	}
+	return count;
+}
+
+/**
+ * Parse a whole number, the whole token and nothing but.
+ * 
+ * @params
+ * 	string_view token: The token.
+ * 	int out (reference): Set to the number.
+ * @return true if the token was a number.
+ */
+bool parseInt(string_view token, int & out) {
+	const char * end = token.data() + token.size();
+	from_chars_result result = from_chars(token.data(), end, out);
+	return !token.empty() && result.ec == errc() && result.ptr == end;
+}
+
+/**
+ * Parse a finite decimal number, the whole token and nothing but. "inf", "nan" and numbers too big
+ * for a double are refused.
+ * 
+ * @params
+ * 	string_view token: The token.
+ * 	double out (reference): Set to the number.
+ * @return true if the token was a finite number.
+ */
+bool parseDouble(string_view token, double & out) {
+	char buffer[32], * end = nullptr;
+	if(token.empty() || token.size() >= sizeof(buffer)) return false;
+	memcpy(buffer, token.data(), token.size());
+	buffer[token.size()] = '\0';
+	out = strtod(buffer, &end);
+	return end == buffer + token.size() && isfinite(out);
+}
+
+/**
+ * Parse the length of a wait or a ramp.
+ * 
+ * @params
+ * 	string_view token: The token.
+ * 	double out (reference): Set to the length (s).
+ * @return true if the token was a number of seconds [0 - MAX_STEP_SECONDS].
+ */
+bool parseSeconds(string_view token, double & out) {
+	return parseDouble(token, out) && out >= 0 && out <= MAX_STEP_SECONDS;
+}
+
+/**
+ * Parse and check one JORS command, already split into words, without allocating. The console
+ * parses its drive, steer, break and ramp commands with this too.
+ * 
+ * @params
+ * 	string_view tokens (pointer): The words of the line, as split by splitWords() into MAX_WORDS.
+ * 	size_t count: How many words there are.
+ * 	string_view line: The whole line.
+ * 	int number: Its line number.
+ * 	long long at (reference): When the line is due, from the start of the routine; advanced by waits (ns).
+ * 	JORSStep step (reference): Filled in with the compiled step.
+ * 	const char * error (reference): Set to what is wrong with the line, if anything.
+ * @return true if the line compiled to a step.
+ */
+bool parseJORSWords(const string_view * tokens, size_t count, string_view line, int number, long long & at, JORSStep & step, 
+	const char * & error) {
+	error = nullptr;
+	step = { JORS_BREAK, 0, chrono::microseconds(0), 0, 0, RAMP_LINEAR, number, at, line };
+	COMMANDWORD word = lookupWord(tokens[0]);
+	if(word == WORD_DRIVE) {
+		if(count != 3 || (tokens[1] != "f" && tokens[1] != "b")) 
+			error = "Drive must be specified as: drive (f or b) (0 - 100)[%].";
+		else if(!parseInt(tokens[2], step.percent) || step.percent < 0 || step.percent > 100) 
+			error = "Drive speed must be a whole percentage from 0 to 100.";
+		else {
+			step.op = (tokens[1] == "f") ? JORS_DRIVE_FORWARD : JORS_DRIVE_REVERSE;
+			step.pulse = (step.op == JORS_DRIVE_FORWARD) ? DRIVE_FORWARD[step.percent] : DRIVE_REVERSE[step.percent];
+		}
+	} else if(word == WORD_STEER) {
+		int time;
+		if(count != 2 || !parseInt(tokens[1], time) || time < STEER_MIN || time > STEER_MAX) 
+			error = "Steer must be specified as: steer (1200 - 2000)[ms * 1000].";
+		else {
+			step.op = JORS_STEER;
+			step.pulse = steerPulse(time);
+		}
+	} else if(word == WORD_BREAK) {
+		if(count != 1) error = "Break takes no arguments.";
+		else step.op = JORS_BREAK;
+	} else if(word == WORD_WAIT) {
+		if(count != 2 || !parseSeconds(tokens[1], step.seconds)) 
+			error = "Wait time must be specified as: wait (float)[time in seconds, up to 1000000].";
+		else if(at + llround(step.seconds * PWM::NANOS_PER_SECOND) > MAX_ROUTINE_LENGTH)
+			error = "The routine would run for longer than 10000000 seconds.";
+		else {
+			step.op = JORS_WAIT;
+			at += llround(step.seconds * PWM::NANOS_PER_SECOND);
+		}
+	} else if(word == WORD_LOG) {
+		step.op = JORS_LOG;
+	} else if(word == WORD_RAMP || word == WORD_CURVE) {
+		// A ramp takes no time on the timeline; the car carries on with it through the next wait.
+		step.curve = (word == WORD_CURVE) ? RAMP_SMOOTH : RAMP_LINEAR;
+		if(tokens[1] == "drive") {
+			if(count != 6 || (tokens[2] != "f" && tokens[2] != "b")) 
+				error = "Drive ramp must be specified as: ramp drive (f or b) (0 - 100)[%] (0 - 100)[%] (float)[time in seconds].";
+			else if(!parseInt(tokens[3], step.from) || step.from < 0 || step.from > 100
+				|| !parseInt(tokens[4], step.percent) || step.percent < 0 || step.percent > 100) 
+				error = "Drive ramp speeds must be whole percentages from 0 to 100.";
+			else if(!parseSeconds(tokens[5], step.seconds)) 
+				error = "Ramp time must be a number of seconds, up to 1000000.";
+			else {
+				step.op = (tokens[2] == "f") ? JORS_RAMP_DRIVE_FORWARD : JORS_RAMP_DRIVE_REVERSE;
+				step.pulse = (step.op == JORS_RAMP_DRIVE_FORWARD) ? DRIVE_FORWARD[step.percent] : DRIVE_REVERSE[step.percent];
+			}
+		} else if(tokens[1] == "steer") {
+			int time;
+			if(count != 5 || !parseInt(tokens[2], step.from) || step.from < STEER_MIN || step.from > STEER_MAX
+				|| !parseInt(tokens[3], time) || time < STEER_MIN || time > STEER_MAX) 
+				error = "Steer ramp must be specified as: ramp steer (1200 - 2000)[ms * 1000] (1200 - 2000)[ms * 1000] (float)[time in seconds].";
+			else if(!parseSeconds(tokens[4], step.seconds)) 
+				error = "Ramp time must be a number of seconds, up to 1000000.";
+			else {
+				step.op = JORS_RAMP_STEER;
+				step.pulse = steerPulse(time);
+			}
+		} else error = "Only drive and steer can be ramped.";
+	} else error = "Unknown command.";
+	return error == nullptr;
+}
+
+/**
+ * Parse and check one JORS line, without allocating. Blank lines compile to nothing.
+ * 
+ * @params
+ * 	string_view line: The line.
+ * 	int number: Its line number.
+ * 	long long at (reference): When the line is due, from the start of the routine; advanced by waits (ns).
+ * 	JORSStep step (reference): Filled in with the compiled step.
+ * 	const char * error (reference): Set to what is wrong with the line, if anything.
+ * @return true if the line compiled to a step.
+ */
+bool parseJORSLine(string_view line, int number, long long & at, JORSStep & step, const char * & error) {
+	error = nullptr;
+	if(!line.empty() && line.back() == '\r') line.remove_suffix(1);
+	if(line.empty()) return false;
+	string_view tokens[MAX_WORDS];
+	size_t count = splitWords(line, tokens, MAX_WORDS);
+	return parseJORSWords(tokens, count, line, number, at, step, error);
+}
+
+/**
+ * Compile a JORS script. Every line is parsed and checked before anything runs, and every error
+ * is reported with its line number, so a mistake at the end of a script can no longer stop the
+ * car halfway through it.
+ * 
+ * @params
+ * 	istream in (reference): The script.
+ * 	JORSProgram program (reference): Filled in with the compiled routine.
+ * @return the number of errors found (the program is only fit to run if this is 0).
+ */
+int compileJORS(istream & in, JORSProgram & program) {
+	int errors = 0;
+	long long at = 0;
+	string line;
+	program.steps.clear();
+	program.source.clear();
+	while(getline(in, line)) program.source.push_back(line);
+	// The steps point into the source, so it is read in full first.
+	for(size_t i = 0; i < program.source.size(); i++) {
+		JORSStep step;
+		const char * error;
+		if(parseJORSLine(program.source[i], i + 1, at, step, error)) program.steps.push_back(step);
+		else if(error != nullptr) {
+			log("JORS Syntax Error", "Line " + to_string(i + 1) + ": " + error);
+			errors++;
+		}
+	}
+	program.length = at;
+	return errors;
+}
+
+/**
+ * Start a ramp step. The PWM output thread works out every period's pulse width along the ramp,
+ * so this returns at once and the car carries on along the ramp while the routine or console moves
+ * on. A ramp backwards queues behind a drive sequence in progress, as driveAt() does.
+ * 
+ * @params
+ * 	JORSStep step (reference): The ramp step.
+ * 	bool dlog (reference): The state of the JacobianOS log option (writing output to console).
+ * 	bool reverse (reference): The state of the reverse mode on the car.
+ * 	PWM drive (reference): The driver PWM channel.
+ * 	PWM steer (reference): The steer PWM channel.
+ */
+void startRamp(const JORSStep & step, bool & dlog, bool & reverse, PWM & drive, PWM & steer) {
+	chrono::nanoseconds length(llround(step.seconds * PWM::NANOS_PER_SECOND));
+	switch(step.op) {
+		case JORS_RAMP_DRIVE_FORWARD:
+			reverse = false;
+			drive.rampPulseWidth(DRIVE_FORWARD[step.from], step.pulse, length, step.curve);
+			if(dlog) log("Success", "The car is now ramping forward from " + to_string(step.from) + "% to " 
+				+ to_string(step.percent) + "% of its top speed over " + to_string(step.seconds) + "s.");
+			break;
+		case JORS_RAMP_DRIVE_REVERSE:
+			// Going backwards needs the ESC's arming sequence first, which leaves the car at the start of the ramp.
+			if(!reverse) driveAt(false, step.from, dlog, reverse, drive);
+			{
+				PulseSegment ramp = { DRIVE_REVERSE[step.from], step.pulse, length, step.curve };
+				drive.sequencePulseWidth(&ramp, 1, true);
+			}
+			if(dlog) log("Success", "The car is now ramping backwards from " + to_string(step.from) + "% to " 
+				+ to_string(step.percent) + "% of its top speed over " + to_string(step.seconds) + "s.");
+			break;
+		case JORS_RAMP_STEER:
+			steer.rampPulseWidth(steerPulse(step.from), step.pulse, length, step.curve);
+			if(dlog) log("Success", "The steering pulse width is now ramping from " + to_string(step.from / 1000.0f) 
+				+ " to " + to_string(step.pulse.count() / 1000.0f) + " over " + to_string(step.seconds) + "s.");
+			break;
+		default:
+			break;
+	}
+	return;
+}
+
+/**
+ * Carry out one compiled JORS step, now. The console carries out its drive, steer, break and ramp
+ * commands with this too.
+ * 
+ * @params
+ * 	JORSStep step (reference): The step.
+ * 	bool dlog (reference): The state of the JacobianOS log option (writing output to console).
+ * 	bool reverse (reference): The state of the reverse mode on the car.
+ * 	PWM drive (reference): The driver PWM channel.
+ * 	PWM steer (reference): The steer PWM channel.
+ */
+void executeJORS(const JORSStep & step, bool & dlog, bool & reverse, PWM & drive, PWM & steer) {
+	switch(step.op) {
+		case JORS_DRIVE_FORWARD: 
+			driveAt(true, step.percent, dlog, reverse, drive);
+			break;
+		case JORS_DRIVE_REVERSE: 
+			driveAt(false, step.percent, dlog, reverse, drive);
+			break;
+		case JORS_STEER:
+			steer.setPulseWidth(step.pulse);
+			if(dlog) log("Success", "The steering pulse width is now set to: " + to_string(step.pulse.count() / 1000.0f));
+			break;
+		case JORS_BREAK:
+			invokeBreak(reverse, dlog, drive);
+			break;
+		case JORS_WAIT:
+			// The wait itself is the deadline of the next step.
+			break;
+		case JORS_LOG:
+			log("JORS Log", (step.text.size() > 4) ? step.text.substr(4) : string_view());
+			break;
+		case JORS_RAMP_DRIVE_FORWARD: case JORS_RAMP_DRIVE_REVERSE: case JORS_RAMP_STEER:
+			startRamp(step, dlog, reverse, drive, steer);
+			break;
+	}
+	return;
+}
+
+/*******************
+Streaming JORS
+/*******************/
+
+/**
+ * The streaming parser thread. It parses a mapped script line by line, without allocating, and
+ * queues the steps for the executor, staying at most STREAM_AHEAD steps ahead of it.
+ * 
+ * @params
+ * 	const char * data: The mapped script.
+ * 	size_t size: Its size in bytes.
+ * 	JORSStream stream (reference): The queue.
+ */
+void parseStream(const char * data, size_t size, JORSStream & stream) {
+	long long at = 0, waited = 0, start = monotonicNanos();
+	size_t position = 0;
+	int number = 0;
+	while(position < size && !stream.cancel.load(memory_order_relaxed)) {
+		const char * newline = (const char *)memchr(data + position, '\n', size - position);
+		size_t end = (newline != nullptr) ? newline - data : size;
+		string_view line(data + position, end - position);
+		position = end + 1;
+		number++;
+		JORSStep step;
+		const char * error;
+		if(!parseJORSLine(line, number, at, step, error)) {
+			if(error == nullptr) continue;
+			stream.error = error;
+			stream.errorLine = number;
+			break;
+		}
+		size_t head = stream.head.load(memory_order_relaxed);
+		if(head - stream.tail.load(memory_order_acquire) == STREAM_AHEAD) {
+			long long full = monotonicNanos();
+			while(head - stream.tail.load(memory_order_acquire) == STREAM_AHEAD && !stream.cancel.load(memory_order_relaxed))
+				this_thread::sleep_for(chrono::microseconds(200));
+			waited += monotonicNanos() - full;
+		}
+		stream.steps[head % STREAM_AHEAD] = step;
+		stream.head.store(head + 1, memory_order_release);
+	}
+	stream.lines = number;
+	stream.length = at;
+	stream.parsing = monotonicNanos() - start - waited;
+	stream.done.store(true, memory_order_release);
+	return;
+}
+
+/**
+ * Take the next step from the streaming parser, for the executor. If the queue is empty this waits
+ * until the parser delivers a step, reaches the end of the script or an error, or the routine is
+ * called off. A step that was already due by the time it was delivered counts as an underrun.
+ * 
+ * @params
+ * 	JORSStream stream (reference): The queue.
+ * 	long long start: When the routine started (CLOCK_MONOTONIC ns).
+ * 	atomic<bool> cancel (reference): Set when the routine is called off.
+ * 	JORSStep step (reference): Filled in with the step.
+ * @return true if there was a step, false if the script is over or the routine was called off.
+ */
+bool takeStream(JORSStream & stream, long long start, const atomic<bool> & cancel, JORSStep & step) {
+	size_t tail = stream.tail.load(memory_order_relaxed);
+	if(tail == stream.head.load(memory_order_acquire)) {
+		// The queue is empty: the routine is over, or the parser has fallen behind.
+		long long empty = monotonicNanos();
+		while(tail == stream.head.load(memory_order_acquire) && !stream.done.load(memory_order_acquire) 
+			&& !cancel.load(memory_order_relaxed))
+			this_thread::sleep_for(chrono::microseconds(20));
+		if(tail == stream.head.load(memory_order_acquire) || cancel.load(memory_order_relaxed)) return false;
+		long long due = start + stream.steps[tail % STREAM_AHEAD].at, now = monotonicNanos();
+		if(now > due) {
+			stream.underruns++;
+			stream.starved += now - max(empty, due);
+		}
+	}
+	step = stream.steps[tail % STREAM_AHEAD];
+	stream.tail.store(tail + 1, memory_order_release);
+	return true;
+}
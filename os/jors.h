@@ -0,0 +1,197 @@
+/**
+ * The JacobianOS Routine Script (*.jors) compiler and the car's drive commands, shared by
+ * JacobianOS and by jacobiantest, which checks them without a car. The console parses its drive,
+ * steer, break and ramp commands with the same code.
+ *
+ * @author Ian Wilkey (iwilkey)
+ * @since JacobianOS 1.2.0
+ */
+
+#ifndef JORS_H
+#define JORS_H
+
+#include <array>
+#include <chrono>
+#include <string_view>
+#include <istream>
+#include "../jacobian.h"
+using namespace std;
+using namespace jacobian;
+
+/*******************
+Pulse widths
+/*******************/
+
+// Fixed pulse widths understood by the drive ESC.
+static constexpr chrono::microseconds NEUTRAL_PULSE(1500), // Stopped.
+	FULL_FORWARD_PULSE(2000),
+	FULL_REVERSE_PULSE(1000), // Also the brake pulse while moving forward.
+	ARM_BRAKE_PULSE(1050), // Held to begin the reverse arming sequence.
+	REVERSE_BRAKE_PULSE(1600); // Brake pulse while moving backwards.
+
+// How long the timed drive sequences hold each pulse. These should be tweaked to find the shortest that work.
+static constexpr chrono::milliseconds ARM_BRAKE_HOLD(1000), // Brake held to begin the reverse arming sequence.
+	ARM_RESET_HOLD(250), // Neutral pulsed to finish it.
+	BRAKE_HOLD(100); // Brake held to stop the car.
+
+// When the reverse arming sequence last started is over (CLOCK_MONOTONIC ns), as the output loop will run it.
+extern long long armedAt;
+
+// Steering servo pulse width range, full right to full left.
+static constexpr int STEER_MIN = 1200,
+	STEER_MAX = 2000;
+static constexpr chrono::microseconds STEER_CENTER_PULSE(1600);
+
+/**
+ * Build the table of drive pulse widths for every whole percentage of top speed, moving
+ * linearly from neutral (0%) to the given full speed pulse (100%).
+ * 
+ * @params
+ * 	chrono::microseconds full: The pulse width at full speed.
+ * @return the pulse widths indexed by percentage [0 - 100].
+ */
+static constexpr array<chrono::microseconds, 101> makeDriveTable(chrono::microseconds full) {
+	array<chrono::microseconds, 101> table{};
+	for(int percent = 0; percent <= 100; percent++)
+		table[percent] = NEUTRAL_PULSE + (full - NEUTRAL_PULSE) * percent / 100;
+	return table;
+}
+
+// Drive pulse widths by percentage of top speed, computed at compile time.
+static constexpr array<chrono::microseconds, 101> DRIVE_FORWARD = makeDriveTable(FULL_FORWARD_PULSE),
+	DRIVE_REVERSE = makeDriveTable(FULL_REVERSE_PULSE);
+
+/**
+ * Map a steer command to its pulse width. The command already is the pulse width in
+ * microseconds, so this only clamps it to the range of the servo.
+ * 
+ * @params
+ * 	int time: The commanded pulse width (ms * 1000).
+ * @return the pulse width to deliver.
+ */
+static constexpr chrono::microseconds steerPulse(int time) {
+	return chrono::microseconds((time > STEER_MAX) ? STEER_MAX : (time < STEER_MIN) ? STEER_MIN : time);
+}
+
+/*******************
+Drive commands
+/*******************/
+
+void driveAt(bool, int, bool &, bool &, PWM &);
+void invokeBreak(bool &, bool &, PWM &);
+
+/*******************
+Command words
+/*******************/
+
+// Every command word understood by the console or in a JORS routine.
+enum COMMANDWORD {
+	WORD_UNKNOWN,
+	WORD_HELP,
+	WORD_LOG,
+	WORD_LOAD,
+	WORD_STREAM,
+	WORD_STOP,
+	WORD_DRIVE,
+	WORD_BREAK,
+	WORD_STEER,
+	WORD_RAMP,
+	WORD_CURVE,
+	WORD_WAIT,
+	WORD_OVERRIDE,
+	WORD_JITTER,
+	WORD_GPIO,
+	WORD_TRANSMITTER,
+	WORD_ENCODER,
+	WORD_BENCH,
+	WORDS
+};
+
+// The most words a command line is split into: one more than the longest command, to catch extra arguments.
+#define MAX_WORDS 7
+
+COMMANDWORD lookupWord(string_view);
+size_t splitWords(string_view, string_view *, size_t);
+
+/*******************
+JacobianOS Routine Script
+/*******************/
+
+// What a compiled JORS step does.
+enum JORSOP {
+	JORS_DRIVE_FORWARD,
+	JORS_DRIVE_REVERSE,
+	JORS_STEER,
+	JORS_BREAK,
+	JORS_WAIT,
+	JORS_LOG,
+	JORS_RAMP_DRIVE_FORWARD,
+	JORS_RAMP_DRIVE_REVERSE,
+	JORS_RAMP_STEER
+};
+
+// One compiled JORS line, with its arguments already parsed, checked and converted.
+struct JORSStep {
+	JORSOP op;
+	int percent; // Drive: percentage of top speed (ramps: the percentage they end on).
+	chrono::microseconds pulse; // Drive and steer: the pulse width to deliver (ramps: the pulse width they end on).
+	double seconds; // Wait and ramps: how long.
+	int from; // Ramps: the percentage (drive) or pulse width (steer) they start from.
+	int curve; // Ramps: a RAMPCURVE.
+	int line; // The script line it came from.
+	long long at; // When the step is due, from the start of the routine (ns).
+	string_view text; // The line itself, for logging and the flight recorder.
+};
+
+// The longest a single wait or ramp may be (s), and the latest a routine may end (ns). Both keep the
+// routine's nanosecond timeline far from overflowing, however many waits it adds up.
+static constexpr double MAX_STEP_SECONDS = 1e6; // About 11 days.
+static constexpr long long MAX_ROUTINE_LENGTH = 10000000LL * PWM::NANOS_PER_SECOND; // About 115 days.
+
+// A compiled JORS routine. The source lines are kept for the steps' text to point into.
+struct JORSProgram {
+	vector<JORSStep> steps;
+	vector<string> source; // Every line of the script.
+	long long length; // When the routine is due to end, from its start (ns).
+};
+
+bool parseInt(string_view, int &);
+bool parseDouble(string_view, double &);
+bool parseSeconds(string_view, double &);
+bool parseJORSWords(const string_view *, size_t, string_view, int, long long &, JORSStep &, const char * &);
+bool parseJORSLine(string_view, int, long long &, JORSStep &, const char * &);
+int compileJORS(istream &, JORSProgram &);
+void startRamp(const JORSStep &, bool &, bool &, PWM &, PWM &);
+void executeJORS(const JORSStep &, bool &, bool &, PWM &, PWM &);
+
+/*******************
+Streaming JORS
+/*******************/
+
+// Steps the streaming parser may run ahead of the executor (a power of two).
+#define STREAM_AHEAD 4096
+
+/**
+ * The bounded queue between the streaming parser thread and the executor. There is one producer
+ * and one consumer, so the queue is a plain ring with two atomic indices.
+ */
+struct JORSStream {
+	JORSStep steps[STREAM_AHEAD];
+	atomic<size_t> head, // Steps parsed; written by the parser.
+		tail; // Steps taken; written by the executor.
+	atomic<bool> done, // The parser has reached the end of the script, or an error.
+		cancel; // The executor wants the parser to stop.
+	// Written by the parser before it sets done.
+	const char * error = nullptr;
+	int errorLine = 0, lines = 0;
+	long long length = 0, // When the routine is due to end, from its start (ns).
+		parsing = 0; // Time the parser spent parsing, not counting waits for room in the queue (ns).
+	// Written by the executor.
+	long long underruns = 0, // Steps that were already due when the parser delivered them.
+		starved = 0; // How long those steps were held up in total (ns).
+};
+
+void parseStream(const char *, size_t, JORSStream &);
+bool takeStream(JORSStream &, long long, const atomic<bool> &, JORSStep &);
+
+#endif